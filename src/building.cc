@@ -25,6 +25,7 @@
 #include "src/inventory.h"
 #include "src/debug.h"
 #include "src/savegame.h"
+#include "src/state-hash.h"
 
 Building::Building(Game *game, unsigned int index)
   : GameObject(game, index) {
@@ -49,6 +50,8 @@ Building::Building(Game *game, unsigned int index)
     stock[j].available = 0;
     stock[j].requested = 0;
     stock[j].maximum = 0;
+    demand_type[j] = Resource::TypeNone;
+    demand_prio[j] = 0;
   }
 
   first_knight = 0;
@@ -113,6 +116,7 @@ Building::start_building(Building::Type _type) {
     stock[1].prio = 0;
     stock[1].maximum = const_info[type].stones;
   }
+  update_demand();
 
   return map_obj;
 }
@@ -182,6 +186,17 @@ Building::increase_mining(int res) {
   }
 }
 
+void
+Building::set_owner(unsigned int new_owner) {
+  unsigned int old_owner = owner;
+  report_demand(-1);
+  owner = new_owner;
+  report_demand(1);
+  /* New buildings start out with the first player as owner, so they are
+     only registered here. */
+  game->building_owner_changed(this, old_owner);
+}
+
 void
 Building::set_first_knight(unsigned int serf) {
   first_knight = serf;
@@ -314,6 +329,7 @@ Building::add_requested_resource(Resource::Type res, bool fix_priority) {
         stock[j].prio = 0;
       }
       stock[j].requested += 1;
+      update_demand();
       return true;
     }
   }
@@ -327,6 +343,26 @@ Building::stock_init(unsigned int stock_num, Resource::Type res_type,
   stock[stock_num].type = res_type;
   stock[stock_num].prio = 0;
   stock[stock_num].maximum = maximum;
+  update_demand();
+}
+
+void
+Building::update_demand() {
+  for (int j = 0; j < kMaxStock; j++) {
+    if (stock[j].type != demand_type[j] || stock[j].prio != demand_prio[j]) {
+      game->resource_demand_changed(owner, demand_type[j], demand_prio[j], -1);
+      demand_type[j] = stock[j].type;
+      demand_prio[j] = stock[j].prio;
+      game->resource_demand_changed(owner, demand_type[j], demand_prio[j], 1);
+    }
+  }
+}
+
+void
+Building::report_demand(int count) {
+  for (int j = 0; j < kMaxStock; j++) {
+    game->resource_demand_changed(owner, demand_type[j], demand_prio[j], count);
+  }
 }
 
 void
@@ -540,6 +576,7 @@ Building::update(unsigned int tick) {
     }
   } else {
     update();
+    update_demand();
   }
 }
 
@@ -1249,6 +1286,36 @@ building_get_score_from_type(Building::Type type) {
   return building_score_from_type[type-1];
 }
 
+void
+Building::hash_state(StateHash *hash) const {
+  hash->add(index);
+  hash->add(pos);
+  hash->add(static_cast<uint32_t>(type));
+  hash->add(owner);
+  hash->add(threat_level);
+  hash->add((constructing ? 1 : 0) | (playing_sfx ? 2 : 0) |
+            (serf_request_failed ? 4 : 0) | (serf_requested ? 8 : 0) |
+            (burning ? 16 : 0) | (active ? 32 : 0) | (holder ? 64 : 0));
+  hash->add(flag);
+
+  for (unsigned int i = 0; i < kMaxStock; i++) {
+    hash->add_words(stock[i]);
+  }
+
+  hash->add(first_knight);
+  hash->add(static_cast<uint32_t>(burning_counter));
+  hash->add(static_cast<uint32_t>(progress));
+
+  /* The union holds a pointer for inventories, hash its index instead. */
+  if (burning) {
+    hash->add(u.tick);
+  } else if (has_inventory()) {
+    hash->add(u.inventory != nullptr ? u.inventory->get_index() : 0);
+  } else {
+    hash->add(u.level);
+  }
+}
+
 SaveReaderBinary&
 operator >> (SaveReaderBinary &reader, Building &building) {
   uint32_t v32;
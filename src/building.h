@@ -34,6 +34,7 @@ class Serf;
 class SaveReaderBinary;
 class SaveReaderText;
 class SaveWriterText;
+class StateHash;
 
 class Building : public GameObject {
  public:
@@ -98,6 +99,10 @@ class Building : public GameObject {
   unsigned int flag;
   /* Stock of this building */
   Stock stock[kMaxStock];
+  /* Stock types and priorities as last reported to the resource demand
+     of the game (see Game::get_resource_demand()). */
+  Resource::Type demand_type[kMaxStock];
+  int demand_prio[kMaxStock];
   unsigned int first_knight;
   int burning_counter;
   int progress;
@@ -132,7 +137,7 @@ class Building : public GameObject {
                                     (type == TypeCastle); }
   /* Owning player of the building. */
   unsigned int get_owner() const { return owner; }
-  void set_owner(unsigned int new_owner) { owner = new_owner; }
+  void set_owner(unsigned int new_owner);
   /* Whether construction of the building is finished. */
   bool is_done() const { return !constructing; }
   bool is_leveling() const { return (!is_done() && progress == 0); }
@@ -193,6 +198,12 @@ class Building : public GameObject {
   Serf *call_attacker_out(int knight_index);
 
   bool add_requested_resource(Resource::Type res, bool fix_priority);
+  /* Report the stock priorities changed since the last call to the
+     resource demand of the game. */
+  void update_demand();
+  /* Add (count 1) or remove (count -1) the reported stock priorities
+     from the resource demand of the owner. */
+  void report_demand(int count);
   bool is_stock_active(int stock_num) const {
     return (stock[stock_num].type > 0); }
   unsigned int get_res_count_in_stock(int stock_num) const {
@@ -208,8 +219,10 @@ class Building : public GameObject {
     return stock[stock_num].maximum; }
   int get_requested_in_stock(int stock_num) const {
     return stock[stock_num].requested; }
+  int get_priority_in_stock(int stock_num) const {
+    return stock[stock_num].prio; }
   void set_priority_in_stock(int stock_num, int priority) {
-    stock[stock_num].prio = priority; }
+    stock[stock_num].prio = priority; update_demand(); }
   void set_initial_res_in_stock(int stock_num, int count) {
     stock[stock_num].available = count; }
   void requested_resource_delivered(Resource::Type resource);
@@ -241,6 +254,9 @@ class Building : public GameObject {
 
   void update(unsigned int tick);
 
+  /* Add the building state to hash. */
+  void hash_state(StateHash *hash) const;
+
   friend SaveReaderBinary&
     operator >> (SaveReaderBinary &reader, Building &building);
   friend SaveReaderText&
@@ -144,6 +144,16 @@ EventLoopSDL::run() {
       case SDL_MOUSEBUTTONDOWN:
         break;
       case SDL_MOUSEMOTION:
+        if ((event.motion.state & (SDL_BUTTON_LMASK | SDL_BUTTON_MMASK |
+                                   SDL_BUTTON_RMASK)) == 0) {
+          int x = static_cast<int>(static_cast<float>(event.motion.x) *
+                                   zoom_factor * screen_factor_x);
+          int y = static_cast<int>(static_cast<float>(event.motion.y) *
+                                   zoom_factor * screen_factor_y);
+          notify_move(x, y);
+          break;
+        }
+
         for (int button = 1; button <= 3; button++) {
           if (event.motion.state & SDL_BUTTON(button)) {
             if (drag_button == 0) {
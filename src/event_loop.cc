@@ -92,6 +92,17 @@ EventLoop::notify_drag(int x, int y, int dx, int dy, Event::Button button) {
   return notify_handlers(&event);
 }
 
+bool
+EventLoop::notify_move(int x, int y) {
+  Event event;
+  event.type = Event::TypeMove;
+  event.x = x;
+  event.y = y;
+  event.dx = 0;
+  event.dy = 0;
+  return notify_handlers(&event);
+}
+
 bool
 EventLoop::notify_key_pressed(unsigned char key, unsigned char morifier) {
   Event event;
@@ -31,6 +31,7 @@ class Event {
     TypeClick,
     TypeDoubleClick,
     TypeDrag,
+    TypeMove,
     TypeKeyPressed,
     TypeResize,
     TypeUpdate,
@@ -113,6 +114,7 @@ class EventLoop {
   bool notify_click(int x, int y, Event::Button button);
   bool notify_dbl_click(int x, int y, Event::Button button);
   bool notify_drag(int x, int y, int dx, int dy, Event::Button button);
+  bool notify_move(int x, int y);
   bool notify_key_pressed(unsigned char key, unsigned char morifier);
   bool notify_resize(unsigned int width, unsigned int height);
   bool notify_update();
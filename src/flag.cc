@@ -27,14 +27,21 @@
 #include "src/savegame.h"
 #include "src/log.h"
 #include "src/inventory.h"
+#include "src/state-hash.h"
 
 #define SEARCH_MAX_DEPTH  0x10000
 
 FlagSearch::FlagSearch(Game *game_) {
   game = game_;
+  game->take_search_queue(&queue);
+  queue_front = 0;
   id = game->next_search_id();
 }
 
+FlagSearch::~FlagSearch() {
+  game->return_search_queue(&queue);
+}
+
 void
 FlagSearch::add_source(Flag *flag) {
   queue.push_back(flag);
@@ -44,13 +51,13 @@ FlagSearch::add_source(Flag *flag) {
 bool
 FlagSearch::execute(flag_search_func *callback, bool land,
                     bool transporter, void *data) {
-  for (int i = 0; i < SEARCH_MAX_DEPTH && !queue.empty(); i++) {
-    Flag *flag = queue.front();
-    queue.erase(queue.begin());
+  for (int i = 0; i < SEARCH_MAX_DEPTH && queue_front < queue.size(); i++) {
+    Flag *flag = queue[queue_front++];
 
     if (callback(flag, data)) {
       /* Clean up */
       queue.clear();
+      queue_front = 0;
       return true;
     }
 
@@ -68,6 +75,7 @@ FlagSearch::execute(flag_search_func *callback, bool land,
 
   /* Clean up */
   queue.clear();
+  queue_front = 0;
 
   return false;
 }
@@ -80,6 +88,212 @@ FlagSearch::single(Flag *src, flag_search_func *callback, bool land,
   return search.execute(callback, land, transporter, data);
 }
 
+/* Direction to take at src to reach the flag with index dest, or
+   DirectionNone if there is no land road to it. */
+Direction
+FlagRoutes::get_direction(Flag *src, unsigned int dest) {
+  auto it = rows.find(src->get_index());
+  if (it == rows.end()) {
+    it = rows.insert(std::make_pair(src->get_index(), Row())).first;
+    search(src, &it->second);
+  }
+
+  const Row &row = it->second;
+  if (dest >= row.size() || row[dest] == RouteNone ||
+      row[dest] == RouteTooFar) {
+    return DirectionNone;
+  }
+  return static_cast<Direction>(row[dest]);
+}
+
+/* Drop the tables that depend on the roads of flag. */
+void
+FlagRoutes::roads_changed(Flag *flag) {
+  unsigned int index = flag->get_index();
+  for (auto it = rows.begin(); it != rows.end();) {
+    const Row &row = it->second;
+    if (it->first == index ||
+        (index < row.size() && row[index] != RouteNone)) {
+      it = rows.erase(it);
+    } else {
+      ++it;
+    }
+  }
+}
+
+/* Breadth first search in the order of FlagSearch::execute(), with the
+   land roads of src as sources. */
+void
+FlagRoutes::search(Flag *src, Row *row) {
+  auto reach = [&](Flag *flag, int8_t dir) {
+    unsigned int index = flag->get_index();
+    if (index >= row->size()) row->resize(index + 1, RouteNone);
+    (*row)[index] = dir;
+    queue.push_back(flag);
+  };
+
+  queue.clear();
+  for (Direction i : cycle_directions_ccw()) {
+    if (!src->is_water_path(i)) reach(src->get_other_end_flag(i), i);
+  }
+
+  size_t front = 0;
+  for (; front < SEARCH_MAX_DEPTH && front < queue.size(); front++) {
+    Flag *flag = queue[front];
+    int8_t dir = (*row)[flag->get_index()];
+    for (Direction i : cycle_directions_ccw()) {
+      if (flag->is_water_path(i)) continue;
+      Flag *other_flag = flag->get_other_end_flag(i);
+      unsigned int index = other_flag->get_index();
+      if (index >= row->size() || (*row)[index] == RouteNone) {
+        reach(other_flag, dir);
+      }
+    }
+  }
+
+  for (; front < queue.size(); front++) {
+    (*row)[queue[front]->get_index()] = RouteTooFar;
+  }
+}
+
+FlagComponents::FlagComponents() {
+  for (int i = 0; i < RoadsCount; i++) base[i] = 1;  /* 0 is no label */
+}
+
+/* Whether the road of flag in direction dir joins components of roads.
+   Transporters count if they serve either end. */
+bool
+FlagComponents::follows(Flag *flag, Direction dir, Roads roads) {
+  if (!flag->has_path(dir)) return false;
+
+  if (roads == RoadsLand) return !flag->is_water_path(dir);
+  return flag->has_transporter(dir) ||
+         flag->other_endpoint.f[dir]->has_transporter(
+                                          flag->get_other_end_dir(dir));
+}
+
+bool
+FlagComponents::is_connected(Flag *flag, Flag *other, Roads roads) {
+  /* Labelling the second flag can merge the component of the first. */
+  size_t index = find(flag, roads);
+  size_t other_index = find(other, roads);
+  return find_root(index, roads) == find_root(other_index, roads);
+}
+
+size_t
+FlagComponents::find(Flag *flag, Roads roads) {
+  if (flag->component[roads] < base[roads]) label(flag, roads);
+  return find_root(flag->component[roads] - base[roads], roads);
+}
+
+size_t
+FlagComponents::find_root(size_t index, Roads roads) {
+  std::vector<Component> &comps = components[roads];
+  while (comps[index].parent != index) {
+    comps[index].parent = comps[comps[index].parent].parent;
+    index = comps[index].parent;
+  }
+  return index;
+}
+
+void
+FlagComponents::merge(size_t index, size_t other, Roads roads) {
+  index = find_root(index, roads);
+  other = find_root(other, roads);
+  if (index == other) return;
+
+  std::vector<Component> &comps = components[roads];
+  if (comps[index].size < comps[other].size) std::swap(index, other);
+  comps[other].parent = index;
+  comps[index].size += comps[other].size;
+  comps[index].inventories += comps[other].inventories;
+  comps[index].resource_inventories += comps[other].resource_inventories;
+  comps[index].serf_inventories += comps[other].serf_inventories;
+}
+
+/* Label the flags connected to flag with a new component. The search
+   stops at flags labelled before and merges with their components. */
+void
+FlagComponents::label(Flag *flag, Roads roads) {
+  std::vector<Component> &comps = components[roads];
+  size_t index = comps.size();
+  unsigned int id = base[roads] + static_cast<unsigned int>(index);
+  comps.push_back(Component{index, 0, 0, 0, 0});
+  Component found = comps.back();
+
+  queue.clear();
+  flag->component[roads] = id;
+  queue.push_back(flag);
+  for (size_t front = 0; front < queue.size(); front++) {
+    Flag *current = queue[front];
+    found.size += 1;
+    if (current->has_inventory()) found.inventories += 1;
+    if (current->accepts_resources()) found.resource_inventories += 1;
+    if (current->accepts_serfs()) found.serf_inventories += 1;
+
+    for (Direction d : cycle_directions_ccw()) {
+      if (!follows(current, d, roads)) continue;
+      Flag *other = current->other_endpoint.f[d];
+      if (other->component[roads] < base[roads]) {
+        other->component[roads] = id;
+        queue.push_back(other);
+      } else if (other->component[roads] != id) {
+        merge(index, other->component[roads] - base[roads], roads);
+      }
+    }
+  }
+
+  Component &root = comps[find_root(index, roads)];
+  root.size += found.size;
+  root.inventories += found.inventories;
+  root.resource_inventories += found.resource_inventories;
+  root.serf_inventories += found.serf_inventories;
+}
+
+void
+FlagComponents::road_joined(Flag *flag, Direction dir) {
+  Flag *other = flag->other_endpoint.f[dir];
+  for (int i = 0; i < RoadsCount; i++) {
+    Roads roads = static_cast<Roads>(i);
+    if (!follows(flag, dir, roads)) continue;
+
+    /* Two unlabelled ends join when their component is labelled. If one
+       end is labelled, label the other now so that its inventories
+       count. */
+    if (flag->component[roads] < base[roads] &&
+        other->component[roads] < base[roads]) {
+      continue;
+    }
+    size_t index = find(flag, roads);
+    merge(index, find(other, roads), roads);
+  }
+}
+
+void
+FlagComponents::transporters_changed(Flag *flag, int old_transporters) {
+  int lost = old_transporters & ~flag->transporters() & 0x3f;
+  if (lost != 0) {
+    drop(RoadsTransporter);
+    return;
+  }
+
+  int gained = flag->transporters() & ~old_transporters;
+  for (Direction d : cycle_directions_ccw()) {
+    if (BIT_TEST(gained, d)) road_joined(flag, d);
+  }
+}
+
+void
+FlagComponents::drop(Roads roads) {
+  base[roads] += static_cast<unsigned int>(components[roads].size());
+  components[roads].clear();
+}
+
+void
+FlagComponents::clear() {
+  for (int i = 0; i < RoadsCount; i++) drop(static_cast<Roads>(i));
+}
+
 Flag::Flag(Game *game, unsigned int index) : GameObject(game, index) {
   pos = 0;
   search_num = 0;
@@ -94,6 +308,11 @@ Flag::Flag(Game *game, unsigned int index) : GameObject(game, index) {
   }
   bld_flags = 0;
   bld2_flags = 0;
+  inventory_for_resource = -1;
+  inventory_for_resource_generation = 0;
+  inventory_for_serf = -1;
+  inventory_for_serf_generation = 0;
+  for (int i = 0; i < FlagComponents::RoadsCount; i++) component[i] = 0;
   for (Direction i : cycle_directions_cw()) {
     length[i] = 0;
     other_end_dir[i] = 0;
@@ -101,8 +320,36 @@ Flag::Flag(Game *game, unsigned int index) : GameObject(game, index) {
   }
 }
 
+void
+Flag::set_has_inventory() {
+  if (!has_inventory()) game->flag_acceptance_changed();
+  bld_flags |= BIT(6);
+}
+
+void
+Flag::set_accepts_resources(bool accepts) {
+  if (accepts != accepts_resources()) game->flag_acceptance_changed();
+  accepts ? bld2_flags |= BIT(7) : bld2_flags &= ~BIT(7);
+}
+
+void
+Flag::set_accepts_serfs(bool accepts) {
+  if (accepts != accepts_serfs()) game->flag_acceptance_changed();
+  accepts ? bld_flags |= BIT(7) : bld_flags &= ~BIT(7);
+}
+
+void
+Flag::clear_flags() {
+  if (accepts_resources() || accepts_serfs()) {
+    game->flag_acceptance_changed();
+  }
+  bld_flags = 0;
+  bld2_flags = 0;
+}
+
 void
 Flag::add_path(Direction dir, bool water) {
+  game->flag_roads_changed(this);
   path_con |= BIT(dir);
   if (water) {
     endpoint &= ~BIT(dir);
@@ -114,6 +361,7 @@ Flag::add_path(Direction dir, bool water) {
 
 void
 Flag::del_path(Direction dir) {
+  game->flag_roads_changed(this);
   path_con &= ~BIT(dir);
   endpoint &= ~BIT(dir);
   transporter &= ~BIT(dir);
@@ -128,6 +376,7 @@ Flag::del_path(Direction dir) {
 
   other_end_dir[dir] &= 0x78;
   other_endpoint.f[dir] = NULL;
+  game->get_flag_components()->clear();
 
   /* Mark resource path for recalculation if they would
    have followed the removed path. */
@@ -222,6 +471,7 @@ Flag::fix_scheduled() {
 typedef struct ScheduleUnknownDestData {
   Resource::Type resource;
   int max_prio;
+  int max_demand;  /* Highest priority of all buildings of the player */
   Flag *flag;
 } ScheduleUnknownDestData;
 
@@ -238,17 +488,20 @@ schedule_unknown_dest_cb(Flag *flag, void *data) {
       dest_data->flag = flag;
     }
 
-    if (dest_data->max_prio > 204) return true;
+    if (dest_data->max_prio > 204 ||
+        dest_data->max_prio == dest_data->max_demand) {
+      return true;
+    }
   }
 
   return false;
 }
 
-void
-Flag::schedule_slot_to_unknown_dest(int slot_num) {
-  /* Resources which should be routed directly to
-   buildings requesting them. Resources not listed
-   here will simply be moved to an inventory. */
+/* Resource type to route directly to the buildings requesting it, or
+   TypeNone if the resource is simply moved to an inventory. Food is
+   handled as one resource group. */
+static Resource::Type
+get_routable_resource(Resource::Type res) {
   const int routable[] = {
     1,  // RESOURCE_FISH
     1,  // RESOURCE_PIG
@@ -279,24 +532,111 @@ Flag::schedule_slot_to_unknown_dest(int slot_num) {
     0,  // RESOURCE_GROUP_FOOD
   };
 
-  Resource::Type res = slot[slot_num].type;
-  if (routable[res]) {
-    FlagSearch search(game);
-    search.add_source(this);
+  if (!routable[res]) return Resource::TypeNone;
+  if (res == Resource::TypeMeat ||
+      res == Resource::TypeFish ||
+      res == Resource::TypeBread) {
+    return Resource::GroupFood;
+  }
+  return res;
+}
+
+typedef struct FindUnknownDestsData {
+  std::vector<Flag*> *dests;
+  ScheduleUnknownDestData slots[FLAG_MAX_RES_COUNT];
+  int remaining;  /* Slots the search would not have stopped for yet */
+} FindUnknownDestsData;
+
+static bool
+find_unknown_dests_cb(Flag *flag, void *d) {
+  FindUnknownDestsData *data = static_cast<FindUnknownDestsData*>(d);
+  if (flag->has_building()) {
+    data->dests->push_back(flag);
+    int i = 0;
+    while (i < data->remaining) {
+      if (schedule_unknown_dest_cb(flag, &data->slots[i])) {
+        data->remaining -= 1;
+        data->slots[i] = data->slots[data->remaining];
+      } else {
+        i++;
+      }
+    }
+    return (data->remaining == 0);
+  }
+  return false;
+}
 
-    /* Handle food as one resource group */
-    if (res == Resource::TypeMeat ||
-        res == Resource::TypeFish ||
-        res == Resource::TypeBread) {
-      res = Resource::GroupFood;
+/* Find the flags with buildings that the unscheduled slots with unknown
+   destination, from slot_num on, may send resources to. The flags are
+   listed in the order a search from this flag over transporter roads
+   reaches them, which does not depend on the priorities, so each slot
+   can scan the list with the priorities as they are when it is
+   scheduled. The search ends once it would have ended for all these
+   slots at the current priorities. Returns false if it ended before
+   reaching every flag, a slot whose scan runs past the end then has to
+   search again. */
+bool
+Flag::find_unknown_dests(int slot_num, std::vector<Flag*> *dests) {
+  FindUnknownDestsData data;
+  data.dests = dests;
+  data.remaining = 0;
+  for (int i = slot_num; i < FLAG_MAX_RES_COUNT; i++) {
+    if (slot[i].type == Resource::TypeNone || slot[i].dir >= 0 ||
+        slot[i].dest != 0) {
+      continue;
     }
+    Resource::Type res = get_routable_resource(slot[i].type);
+    if (res == Resource::TypeNone) continue;
+
+    ScheduleUnknownDestData *slot_data = &data.slots[data.remaining];
+    slot_data->resource = res;
+    slot_data->flag = NULL;
+    slot_data->max_prio = 0;
+    slot_data->max_demand = game->get_resource_demand(get_owner(), res);
+    if (slot_data->max_demand > 0) data.remaining += 1;
+  }
+
+  game->take_search_queue(dests);
+  FlagSearch search(game);
+  search.add_source(this);
+  return !search.execute(find_unknown_dests_cb, false, true, &data);
+}
 
+/* Schedule the slot to the building that requests its resource with the
+   highest priority, scanning the flags found by find_unknown_dests() on
+   first use, or to the nearest inventory. */
+void
+Flag::schedule_slot_to_unknown_dest(int slot_num, UnknownDests *dests) {
+  Resource::Type res = get_routable_resource(slot[slot_num].type);
+  if (res != Resource::TypeNone) {
     ScheduleUnknownDestData data;
     data.resource = res;
     data.flag = NULL;
     data.max_prio = 0;
+    data.max_demand = game->get_resource_demand(get_owner(), res);
+
+    /* No search is needed if no building of the player requests the
+       resource, and it ends at a building with the highest priority. */
+    if (data.max_demand > 0) {
+      if (!dests->searched) {
+        dests->complete = find_unknown_dests(slot_num, &dests->flags);
+        dests->searched = true;
+      }
 
-    search.execute(schedule_unknown_dest_cb, false, true, &data);
+      bool ended = false;
+      for (Flag *flag : dests->flags) {
+        if (schedule_unknown_dest_cb(flag, &data)) {
+          ended = true;
+          break;
+        }
+      }
+      if (!ended && !dests->complete) {
+        data.flag = NULL;
+        data.max_prio = 0;
+        FlagSearch::single(this, schedule_unknown_dest_cb, false, true,
+                           &data);
+      }
+    }
     if (data.flag != nullptr) {
       Log::Verbose["game"] << "dest for flag " << index << " res " << slot
                            << " found: flag " << data.flag->get_index();
@@ -358,15 +698,25 @@ find_nearest_inventory_search_cb(Flag *flag, void *data) {
   return false;
 }
 
-/* Return the flag index of the inventory nearest to flag. */
+/* Return the flag index of the inventory nearest to flag. The result is
+   kept until the game reports a change of the roads, transporters or
+   inventories. */
 int
 Flag::find_nearest_inventory_for_resource() {
-  Flag *dest = NULL;
-  FlagSearch::single(this, find_nearest_inventory_search_cb, false, true,
-                     &dest);
-  if (dest != NULL) return dest->get_index();
+  unsigned int generation = game->get_resource_inventory_generation();
+  if (inventory_for_resource_generation == generation) {
+    return inventory_for_resource;
+  }
 
-  return -1;
+  Flag *dest = NULL;
+  if (game->get_flag_components()->reaches_resource_inventory(this,
+                                            FlagComponents::RoadsTransporter)) {
+    FlagSearch::single(this, find_nearest_inventory_search_cb, false, true,
+                       &dest);
+  }
+  inventory_for_resource = (dest != NULL) ? dest->get_index() : -1;
+  inventory_for_resource_generation = generation;
+  return inventory_for_resource;
 }
 
 static bool
@@ -383,58 +733,50 @@ flag_search_inventory_search_cb(Flag *flag, void *data) {
 
 int
 Flag::find_nearest_inventory_for_serf() {
-  int dest_index = -1;
-  FlagSearch::single(this, flag_search_inventory_search_cb, true, false,
-                     &dest_index);
+  unsigned int generation = game->get_serf_inventory_generation();
+  if (inventory_for_serf_generation == generation) {
+    return inventory_for_serf;
+  }
 
+  int dest_index = -1;
+  if (game->get_flag_components()->reaches_serf_inventory(this,
+                                                   FlagComponents::RoadsLand)) {
+    FlagSearch::single(this, flag_search_inventory_search_cb, true, false,
+                       &dest_index);
+  }
+  inventory_for_serf = dest_index;
+  inventory_for_serf_generation = generation;
   return dest_index;
 }
 
-typedef struct ScheduleKnownDestData {
-  Flag *src;
-  Flag *dest;
-  int slot;
-} ScheduleKnownDestData;
+typedef struct FindKnownDestsData {
+  Flag *dests[FLAG_MAX_RES_COUNT];  /* By slot, NULL if not searched */
+  Direction *dirs;
+  int remaining;
+} FindKnownDestsData;
 
 static bool
-schedule_known_dest_cb(Flag *flag, void *data) {
-  ScheduleKnownDestData *dest_data =
-    static_cast<ScheduleKnownDestData*>(data);
-  return (flag->schedule_known_dest_cb_(dest_data->src,
-                                        dest_data->dest,
-                                        dest_data->slot) != 0);
-}
-
-bool
-Flag::schedule_known_dest_cb_(Flag *src, Flag *dest, int _slot) {
-  if (this == dest) {
-    /* Destination found */
-    if (this->search_dir != 6) {
-      if (!src->is_scheduled(this->search_dir)) {
-        /* Item is requesting to be fetched */
-        src->other_end_dir[this->search_dir] =
-          BIT(7) | (src->other_end_dir[this->search_dir] & 0x78) | _slot;
-      } else {
-        Player *player = game->get_player(this->get_owner());
-        int other_dir = src->other_end_dir[this->search_dir];
-        int prio_old = player->get_flag_prio(src->slot[other_dir & 7].type);
-        int prio_new = player->get_flag_prio(src->slot[_slot].type);
-        if (prio_new > prio_old) {
-          /* This item has the highest priority now */
-          src->other_end_dir[this->search_dir] =
-            (src->other_end_dir[this->search_dir] & 0xf8) | _slot;
-        }
-        src->slot[_slot].dir = this->search_dir;
-      }
+find_known_dests_cb(Flag *flag, void *d) {
+  FindKnownDestsData *data = static_cast<FindKnownDestsData*>(d);
+  for (int i = 0; i < FLAG_MAX_RES_COUNT; i++) {
+    if (data->dests[i] == flag) {
+      data->dirs[i] = flag->get_search_dir();
+      data->dests[i] = NULL;
+      data->remaining -= 1;
     }
-    return true;
   }
-
-  return false;
+  return (data->remaining == 0);
 }
 
-void
-Flag::schedule_slot_to_known_dest(int slot_, unsigned int res_waiting[4]) {
+/* Find the directions in which resources leave towards the known
+   destinations of the unscheduled slots. All slots search from the
+   same roads, the ones that take resources next by res_waiting, so one
+   search finds the destinations of all of them. dirs gets the direction
+   for each slot whose destination was reached, DirectionNone otherwise.
+   Returns the number of roads searched from, or -1 if the resources
+   have to wait for a road. */
+int
+Flag::find_known_dests(unsigned int res_waiting[4], Direction dirs[]) {
   FlagSearch search(game);
 
   search_num = search.get_id();
@@ -489,25 +831,61 @@ Flag::schedule_slot_to_known_dest(int slot_, unsigned int res_waiting[4]) {
           }
         }
       }
-      if (flags == 0) return;
+      if (flags == 0) return -1;
     }
   }
 
-  if (sources > 0) {
-    ScheduleKnownDestData data;
-    data.src = this;
-    data.dest = game->get_flag(this->slot[slot_].dest);
-    data.slot = slot_;
-    bool r = search.execute(schedule_known_dest_cb, false, true, &data);
-    if (!r || data.dest == this) {
-      /* Unable to deliver */
-      game->cancel_transported_resource(this->slot[slot_].type,
-                                        this->slot[slot_].dest);
-      this->slot[slot_].dest = 0;
-      endpoint |= BIT(7);
+  FindKnownDestsData data;
+  data.dirs = dirs;
+  data.remaining = 0;
+  FlagComponents *components = game->get_flag_components();
+  for (int i = 0; i < FLAG_MAX_RES_COUNT; i++) {
+    dirs[i] = DirectionNone;
+    data.dests[i] = NULL;
+    if (slot[i].type != Resource::TypeNone && slot[i].dir < 0 &&
+        slot[i].dest != 0) {
+      Flag *dest = game->get_flag(slot[i].dest);
+      /* The flag itself is never reached */
+      if (dest != this && components->is_connected(this, dest,
+                                            FlagComponents::RoadsTransporter)) {
+        data.dests[i] = dest;
+        data.remaining += 1;
+      }
     }
-  } else {
+  }
+
+  if (sources > 0 && data.remaining > 0) {
+    search.execute(find_known_dests_cb, false, true, &data);
+  }
+  return sources;
+}
+
+/* Schedule the slot towards its known destination, reached in direction
+   dir by find_known_dests() from the given number of sources. */
+void
+Flag::schedule_slot_to_known_dest(int slot_, int sources, Direction dir) {
+  if (sources < 0) return;
+
+  if (sources == 0) {
     endpoint |= BIT(7);
+  } else if (dir == DirectionNone) {
+    /* Unable to deliver */
+    game->cancel_transported_resource(this->slot[slot_].type,
+                                      this->slot[slot_].dest);
+    this->slot[slot_].dest = 0;
+    endpoint |= BIT(7);
+  } else if (!is_scheduled(dir)) {
+    /* Item is requesting to be fetched */
+    other_end_dir[dir] = BIT(7) | (other_end_dir[dir] & 0x78) | slot_;
+  } else {
+    Player *player = game->get_player(get_owner());
+    int prio_old = player->get_flag_prio(slot[other_end_dir[dir] & 7].type);
+    int prio_new = player->get_flag_prio(slot[slot_].type);
+    if (prio_new > prio_old) {
+      /* This item has the highest priority now */
+      other_end_dir[dir] = (other_end_dir[dir] & 0xf8) | slot_;
+    }
+    slot[slot_].dir = dir;
   }
 }
 
@@ -573,6 +951,7 @@ Flag::link_with_flag(Flag *dest_flag, bool water_path, size_t length_,
 
   dest_flag->other_endpoint.f[in_dir] = this;
   other_endpoint.f[out_dir] = dest_flag;
+  game->get_flag_components()->road_joined(this, out_dir);
 }
 
 void
@@ -600,6 +979,7 @@ Flag::restore_path_serf_info(Direction dir, SerfPathInfo *data) {
   other_flag->other_end_dir[other_dir] =
     (other_flag->other_end_dir[other_dir] & 0xc7) | (dir << 3);
 
+  game->flag_roads_changed(other_flag);
   other_endpoint.f[dir] = other_flag;
   other_flag->other_endpoint.f[other_dir] = this;
 
@@ -621,6 +1001,7 @@ Flag::restore_path_serf_info(Direction dir, SerfPathInfo *data) {
     length[dir] |= std::min(data->serf_count, max_serfs);
     other_flag->length[other_dir] |= std::min(data->serf_count, max_serfs);
   }
+  game->get_flag_components()->road_joined(this, dir);
 }
 
 bool
@@ -797,8 +1178,12 @@ Flag::merge_paths(MapPos pos_) {
   flag_2->other_end_dir[dir_2] =
     (flag_2->other_end_dir[dir_2] & 0xc7) | (dir_1 << 3);
 
+  game->flag_roads_changed(flag_1);
+  game->flag_roads_changed(flag_2);
   flag_1->other_endpoint.f[dir_1] = flag_2;
   flag_2->other_endpoint.f[dir_2] = flag_1;
+  /* The merged road may lose the transporters of one of its parts */
+  game->get_flag_components()->clear();
 
   flag_1->transporter &= ~BIT(dir_1);
   flag_2->transporter &= ~BIT(dir_2);
@@ -858,6 +1243,15 @@ Flag::update() {
 
   if (has_resources()) {
     endpoint &= ~BIT(7);
+    /* Directions to the known destinations, found on first use */
+    bool known_searched = false;
+    int known_sources = 0;
+    Direction known_dirs[FLAG_MAX_RES_COUNT];
+    /* Flags with buildings for the unknown destinations, found on first
+       use */
+    UnknownDests unknown_dests;
+    unknown_dests.searched = false;
+    unknown_dests.complete = false;
     for (int slot_ = 0; slot_ < FLAG_MAX_RES_COUNT; slot_++) {
       if (slot[slot_].type != Resource::TypeNone) {
         waiting_count += 1;
@@ -868,17 +1262,26 @@ Flag::update() {
         if (res_dir < 0) {
           if (slot[slot_].dest != 0) {
             /* Destination is known */
-            schedule_slot_to_known_dest(slot_, res_waiting);
+            if (!known_searched) {
+              known_sources = find_known_dests(res_waiting, known_dirs);
+              known_searched = true;
+            }
+            schedule_slot_to_known_dest(slot_, known_sources,
+                                        known_dirs[slot_]);
           } else {
             /* Destination is not known */
-            schedule_slot_to_unknown_dest(slot_);
+            schedule_slot_to_unknown_dest(slot_, &unknown_dests);
           }
         }
       }
     }
+    if (unknown_dests.searched) {
+      game->return_search_queue(&unknown_dests.flags);
+    }
   }
 
   /* Update transporter flags, decide if serf needs to be sent to road */
+  int old_transporter = transporter;
   for (Direction j : cycle_directions_ccw()) {
     if (has_path(j)) {
       if (serf_requested(j)) {
@@ -905,6 +1308,10 @@ Flag::update() {
       }
     }
   }
+  if ((transporter ^ old_transporter) & 0x3f) {
+    game->flag_transporters_changed();
+    game->get_flag_components()->transporters_changed(this, old_transporter);
+  }
 }
 
 typedef struct SendSerfToRoadData {
@@ -958,7 +1365,11 @@ Flag::call_transporter(Direction dir, bool water) {
   SendSerfToRoadData data;
   data.inventory = NULL;
   data.water = water;
-  search.execute(send_serf_to_road_search_cb, true, false, &data);
+  FlagComponents *components = game->get_flag_components();
+  if (components->reaches_inventory(this, FlagComponents::RoadsLand) ||
+      components->reaches_inventory(src_2, FlagComponents::RoadsLand)) {
+    search.execute(send_serf_to_road_search_cb, true, false, &data);
+  }
   Inventory *inventory = data.inventory;
   if (inventory == NULL) {
     return false;
@@ -1023,6 +1434,36 @@ Flag::unlink_building() {
   clear_flags();
 }
 
+void
+Flag::hash_state(StateHash *hash) const {
+  hash->add(index);
+  hash->add(pos);
+  hash->add(static_cast<uint32_t>(path_con));
+  hash->add(static_cast<uint32_t>(endpoint));
+  hash->add(static_cast<uint32_t>(transporter));
+
+  for (Direction d : cycle_directions_cw()) {
+    hash->add(length[d]);
+    if (d == DirectionUpLeft && has_building()) {
+      hash->add(other_endpoint.b[d]->get_index());
+    } else if (has_path(d)) {
+      hash->add(other_endpoint.f[d]->get_index());
+    } else {
+      hash->add(0);
+    }
+    hash->add(static_cast<uint32_t>(other_end_dir[d]));
+  }
+
+  for (int i = 0; i < FLAG_MAX_RES_COUNT; i++) {
+    hash->add(static_cast<uint32_t>(slot[i].type));
+    hash->add(static_cast<uint32_t>(slot[i].dir));
+    hash->add(slot[i].dest);
+  }
+
+  hash->add(static_cast<uint32_t>(bld_flags));
+  hash->add(static_cast<uint32_t>(bld2_flags));
+}
+
 SaveReaderBinary&
 operator >> (SaveReaderBinary &reader, Flag &flag) {
   flag.pos = 0; /* Set correctly later. */
@@ -1108,7 +1549,9 @@ operator >> (SaveReaderText &reader, Flag &flag) {
   reader.value("pos")[0] >> x;
   reader.value("pos")[1] >> y;
   flag.pos = flag.get_game()->get_map()->pos(x, y);
-  reader.value("search_num") >> flag.search_num;
+  unsigned int search_num;
+  reader.value("search_num") >> search_num;
+  flag.search_num = search_num;
   reader.value("search_dir") >> flag.search_dir;
   reader.value("path_con") >> flag.path_con;
   reader.value("endpoints") >> flag.endpoint;
@@ -1149,7 +1592,7 @@ SaveWriterText&
 operator << (SaveWriterText &writer, Flag &flag) {
   writer.value("pos") << flag.game->get_map()->pos_col(flag.pos);
   writer.value("pos") << flag.game->get_map()->pos_row(flag.pos);
-  writer.value("search_num") << flag.search_num;
+  writer.value("search_num") << static_cast<unsigned int>(flag.search_num);
   writer.value("search_dir") << flag.search_dir;
   writer.value("path_con") << flag.path_con;
   writer.value("endpoints") << flag.endpoint;
@@ -22,6 +22,7 @@
 #ifndef SRC_FLAG_H_
 #define SRC_FLAG_H_
 
+#include <unordered_map>
 #include <vector>
 
 #include "src/building.h"
@@ -43,6 +44,7 @@ class Player;
 class SaveReaderBinary;
 class SaveReaderText;
 class SaveWriterText;
+class StateHash;
 
 class Flag : public GameObject {
  protected:
@@ -59,7 +61,7 @@ class Flag : public GameObject {
   int endpoint;
   ResourceSlot slot[FLAG_MAX_RES_COUNT];
 
-  int search_num;
+  uint64_t search_num;
   Direction search_dir;
   int transporter;
   size_t length[6];
@@ -73,6 +75,17 @@ class Flag : public GameObject {
   int bld_flags;
   int bld2_flags;
 
+  /* Results of the nearest inventory searches, valid while the game
+     generation they were found in is current. */
+  int inventory_for_resource;
+  unsigned int inventory_for_resource_generation;
+  int inventory_for_serf;
+  unsigned int inventory_for_serf_generation;
+
+  /* Labels of the components of this flag by kind of roads, see
+     FlagComponents. */
+  unsigned int component[2];
+
  public:
   Flag(Game *game, unsigned int index);
 
@@ -157,12 +170,10 @@ class Flag : public GameObject {
   /* Whether this inventory accepts serfs. */
   bool accepts_serfs() const { return ((bld_flags >> 7) & 1); }
 
-  void set_has_inventory() { bld_flags |= BIT(6); }
-  void set_accepts_resources(bool accepts) { accepts ? bld2_flags |= BIT(7) :
-                                                       bld2_flags &= ~BIT(7); }
-  void set_accepts_serfs(bool accepts) { accepts ? bld_flags |= BIT(7) :
-                                                   bld_flags &= ~BIT(7); }
-  void clear_flags() { bld_flags = 0; bld2_flags = 0; }
+  void set_has_inventory();
+  void set_accepts_resources(bool accepts);
+  void set_accepts_serfs(bool accepts);
+  void clear_flags();
 
   friend SaveReaderBinary&
     operator >> (SaveReaderBinary &reader, Flag &flag);
@@ -171,8 +182,6 @@ class Flag : public GameObject {
   friend SaveWriterText&
     operator << (SaveWriterText &writer, Flag &flag);
 
-  bool schedule_known_dest_cb_(Flag *src, Flag *dest, int slot);
-
   void reset_transport(Flag *other);
 
   void reset_destination_of_stolen_resources();
@@ -208,28 +217,50 @@ class Flag : public GameObject {
   static void fill_path_serf_info(Game *game, MapPos pos, Direction dir,
                                   SerfPathInfo *data);
 
+  /* Add the flag state to hash (without the scratch data of searches). */
+  void hash_state(StateHash *hash) const;
+
  protected:
   void fix_scheduled();
 
-  void schedule_slot_to_unknown_dest(int slot);
-  void schedule_slot_to_known_dest(int slot, unsigned int res_waiting[4]);
+  /* Flags with buildings in the order a search over transporter roads
+     reaches them, shared by the slots with unknown destination. */
+  typedef struct UnknownDests {
+    bool searched;
+    bool complete;  /* The search reached every flag it could */
+    std::vector<Flag*> flags;
+  } UnknownDests;
+
+  bool find_unknown_dests(int slot, std::vector<Flag*> *dests);
+  void schedule_slot_to_unknown_dest(int slot, UnknownDests *dests);
+  int find_known_dests(unsigned int res_waiting[4], Direction dirs[]);
+  void schedule_slot_to_known_dest(int slot, int sources, Direction dir);
   bool call_transporter(Direction dir, bool water);
 
   friend class FlagSearch;
+  friend class FlagComponents;
 };
 
 typedef bool flag_search_func(Flag *flag, void *data);
 
+/* Breadth first search over the roads between flags. The queue is
+   borrowed from the game and given back when the search is destroyed, so
+   searches do not allocate once the game has run for a while. Flags are
+   queued once per search at most, so the front of the queue is an index
+   that only moves forward. */
 class FlagSearch {
  protected:
   Game *game;
   std::vector<Flag*> queue;
-  int id;
+  size_t queue_front;
+  uint64_t id;
 
  public:
   explicit FlagSearch(Game *game);
+  FlagSearch(const FlagSearch &search) = delete;
+  ~FlagSearch();
 
-  int get_id() { return id; }
+  uint64_t get_id() { return id; }
   void add_source(Flag *flag);
   bool execute(flag_search_func *callback,
                bool land, bool transporter, void *data);
@@ -238,4 +269,91 @@ class FlagSearch {
                      bool land, bool transporter, void *data);
 };
 
+/* Directions that serfs take at a flag to walk on land roads towards a
+   destination flag. The table of a source flag holds the direction
+   found by a FlagSearch from the roads of the source for every flag
+   index, including the choice between ties. It is searched on first use
+   and dropped when roads change at a flag it reaches. */
+class FlagRoutes {
+ protected:
+  typedef enum Route {
+    RouteNone = -1,  /* Not reached */
+    RouteTooFar = 6  /* Reached but beyond the search depth */
+  } Route;
+  typedef std::vector<int8_t> Row;  /* Direction or Route by flag index */
+
+  std::unordered_map<unsigned int, Row> rows;
+  std::vector<Flag*> queue;
+
+ public:
+  Direction get_direction(Flag *src, unsigned int dest);
+  void roads_changed(Flag *flag);
+  void clear() { rows.clear(); }
+
+ protected:
+  void search(Flag *src, Row *row);
+};
+
+/* Connected components of the flag graph, for land roads and roads served
+   by transporters, counting the inventories in each. A flag search can
+   only reach inventories in the component of its sources, so searches
+   that must fail are skipped. Every search of the game follows either
+   land roads or transporters, so components over all roads are not kept.
+
+   The component of a flag is labelled on first use. New roads and
+   transporters merge components. A lost transporter drops the labels of
+   transporter roads, while a removed road or a changed inventory drops
+   all labels. Roads count in both directions, so a component can hold
+   more flags than a search reaches but never fewer. */
+class FlagComponents {
+ public:
+  typedef enum Roads {
+    RoadsLand = 0,
+    RoadsTransporter,
+
+    RoadsCount
+  } Roads;
+
+ protected:
+  typedef struct Component {
+    size_t parent;  /* Index of the component it was merged into */
+    unsigned int size;
+    unsigned int inventories;
+    unsigned int resource_inventories;  /* Accepting resources */
+    unsigned int serf_inventories;  /* Accepting serfs */
+  } Component;
+
+  /* Labels of flags are base plus the index of their component, labels
+     below base are left from dropped components. */
+  unsigned int base[RoadsCount];
+  std::vector<Component> components[RoadsCount];
+  std::vector<Flag*> queue;
+
+ public:
+  FlagComponents();
+
+  bool reaches_inventory(Flag *flag, Roads roads) {
+    return get_component(flag, roads).inventories != 0; }
+  bool reaches_resource_inventory(Flag *flag, Roads roads) {
+    return get_component(flag, roads).resource_inventories != 0; }
+  bool reaches_serf_inventory(Flag *flag, Roads roads) {
+    return get_component(flag, roads).serf_inventories != 0; }
+  bool is_connected(Flag *flag, Flag *other, Roads roads);
+
+  /* Merge the components joined by the road of flag in direction dir. */
+  void road_joined(Flag *flag, Direction dir);
+  void transporters_changed(Flag *flag, int old_transporters);
+  void drop(Roads roads);
+  void clear();
+
+ protected:
+  static bool follows(Flag *flag, Direction dir, Roads roads);
+  const Component &get_component(Flag *flag, Roads roads) {
+    return components[roads][find(flag, roads)]; }
+  size_t find(Flag *flag, Roads roads);
+  size_t find_root(size_t index, Roads roads);
+  void merge(size_t index, size_t other, Roads roads);
+  void label(Flag *flag, Roads roads);
+};
+
 #endif  // SRC_FLAG_H_
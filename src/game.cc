@@ -42,13 +42,23 @@
 
 #define GROUND_ANALYSIS_RADIUS  25
 
-Game::Game() {
-  players = Players(this);
-  flags = Flags(this);
-  inventories = Inventories(this);
-  buildings = Buildings(this);
-  serfs = Serfs(this);
-
+Game::Game()
+  : players(this)
+  , flags(this)
+  , inventories(this)
+  , buildings(this)
+  , serfs(this)
+  , player_objects_valid(false)
+  , player_serfs(GAME_MAX_PLAYER_COUNT, PlayerSerfs(&serfs))
+  , player_buildings(GAME_MAX_PLAYER_COUNT, PlayerBuildings(&buildings))
+  , player_inventories(GAME_MAX_PLAYER_COUNT,
+                       PlayerInventories(&inventories))
+  , road_bound_serfs_valid(false)
+  , road_bound_serfs(&serfs)
+  , idle_serfs_valid(false)
+  , resource_inventory_generation(1)
+  , serf_inventory_generation(1)
+  , resource_demand_valid(false) {
   /* Create NULL-serf */
   serfs.allocate();
 
@@ -118,23 +128,32 @@ Game::update_knight_morale() {
   }
 }
 
+/* Number of resource types a building can request, including food. */
+static const int requested_resource_types = Resource::GroupFood + 1;
+
+/* Best destinations found from a set of source inventories, for every
+   resource type at once. */
 typedef struct UpdateInventoriesData {
-  Resource::Type resource;
-  int *max_prio;
-  Flag **flags;
+  std::vector<Flag*> sources;
+  std::vector<int> max_prio;  /* By source and resource type */
+  std::vector<Flag*> flags;
 } UpdateInventoriesData;
 
 bool
 Game::update_inventories_cb(Flag *flag, void *d) {
   UpdateInventoriesData *data = reinterpret_cast<UpdateInventoriesData*>(d);
-  int inv = flag->get_search_dir();
-  if (data->max_prio[inv] < 255 && flag->has_building()) {
-    Building *building = flag->get_building();
+  if (!flag->has_building()) return false;
+
+  Building *building = flag->get_building();
+  size_t offset = flag->get_search_dir() * requested_resource_types;
+  for (unsigned int i = 0; i < Building::kMaxStock; i++) {
+    int type = building->get_res_type_in_stock(i);
+    int prio = building->get_priority_in_stock(i);
+    if (type < 0 || type >= requested_resource_types || prio < 16) continue;
 
-    int bld_prio = building->get_max_priority_for_resource(data->resource, 16);
-    if (bld_prio > data->max_prio[inv]) {
-      data->max_prio[inv] = bld_prio;
-      data->flags[inv] = flag;
+    if (prio > data->max_prio[offset + type]) {
+      data->max_prio[offset + type] = prio;
+      data->flags[offset + type] = flag;
     }
   }
 
@@ -202,6 +221,7 @@ Game::update_inventories() {
     default: arr = arr_1; break;
   }
 
+  std::vector<UpdateInventoriesData> searches;
   while (arr[0] != Resource::TypeNone) {
     for (Player *player : players) {
       Inventory *invs[256];
@@ -238,33 +258,47 @@ Game::update_inventories() {
         }
       }
 
-      if (n == 0) continue;
-
-      FlagSearch search(this);
-
-      int max_prio[256];
-      Flag *flags_[256];
+      /* Without a building requesting the resource there is nothing to
+         search for. */
+      if (n == 0 || get_resource_demand(player->get_index(), arr[0]) < 16) {
+        continue;
+      }
 
+      /* Distributing a resource only lowers the priorities of that
+         resource, so one search from a set of sources finds the
+         destinations of all the following resources as well. */
+      std::vector<Flag*> sources;
       for (int i = 0; i < n; i++) {
-        max_prio[i] = 0;
-        flags_[i] = NULL;
-        Flag *flag = flags[invs[i]->get_flag_index()];
-        flag->set_search_dir((Direction)i);
-        search.add_source(flag);
+        sources.push_back(flags[invs[i]->get_flag_index()]);
       }
 
-      UpdateInventoriesData data;
-      data.resource = arr[0];
-      data.max_prio = max_prio;
-      data.flags = flags_;
-      search.execute(update_inventories_cb, false, true, &data);
+      size_t search = 0;
+      while (search < searches.size() && searches[search].sources != sources) {
+        search += 1;
+      }
+      if (search == searches.size()) {
+        searches.push_back(UpdateInventoriesData());
+        UpdateInventoriesData &data = searches.back();
+        data.sources = sources;
+        data.max_prio.resize(n * requested_resource_types, 0);
+        data.flags.resize(n * requested_resource_types, NULL);
+
+        FlagSearch flag_search(this);
+        for (int i = 0; i < n; i++) {
+          sources[i]->set_search_dir((Direction)i);
+          flag_search.add_source(sources[i]);
+        }
+        flag_search.execute(update_inventories_cb, false, true, &data);
+      }
+      UpdateInventoriesData &data = searches[search];
 
       for (int i = 0; i < n; i++) {
-        if (max_prio[i] > 0) {
+        size_t index = i * requested_resource_types + arr[0];
+        if (data.max_prio[index] > 0) {
           Log::Verbose["game"] << " dest for inventory " << i << "found";
           Resource::Type res = (Resource::Type)arr[0];
 
-          Building *dest_bld = flags_[i]->get_building();
+          Building *dest_bld = data.flags[index]->get_building();
           if (!dest_bld->add_requested_resource(res, false)) {
             throw ExceptionFreeserf("Failed to request resource.");
           }
@@ -399,6 +433,10 @@ Game::send_serf_to_flag(Flag *dest, Serf::Type type, Resource::Type res1,
   data.res1 = res1;
   data.res2 = res2;
 
+  if (!flag_components.reaches_inventory(dest, FlagComponents::RoadsLand)) {
+    return false;
+  }
+
   bool r = FlagSearch::single(dest, send_serf_to_flag_search_cb, true, false,
                               &data);
   if (!r) {
@@ -611,6 +649,8 @@ Game::update_game_stats() {
 /* Update game state after tick increment. */
 void
 Game::update() {
+  TICK_PROFILE_PHASE(&tick_profile, PhaseTotal);
+
   /* Increment tick counters */
   const_tick += 1;
 
@@ -619,17 +659,27 @@ Game::update() {
   tick += game_speed;
   tick_diff = tick - last_tick;
 
-  clear_serf_request_failure();
-  map->update(tick, &init_map_rnd);
+  {
+    TICK_PROFILE_PHASE(&tick_profile, PhaseSerfRequestFailure);
+    clear_serf_request_failure();
+  }
+  {
+    TICK_PROFILE_PHASE(&tick_profile, PhaseMap);
+    map->update(tick, &init_map_rnd);
+  }
 
   /* Update players */
-  for (Player *player : players) {
-    player->update();
+  {
+    TICK_PROFILE_PHASE(&tick_profile, PhasePlayers);
+    for (Player *player : players) {
+      player->update();
+    }
   }
 
   /* Update knight morale */
   knight_morale_counter -= tick_diff;
   if (knight_morale_counter < 0) {
+    TICK_PROFILE_PHASE(&tick_profile, PhaseKnightMorale);
     update_knight_morale();
     knight_morale_counter += 256;
   }
@@ -637,6 +687,7 @@ Game::update() {
   /* Schedule resources to go out of inventories */
   inventory_schedule_counter -= tick_diff;
   if (inventory_schedule_counter < 0) {
+    TICK_PROFILE_PHASE(&tick_profile, PhaseInventories);
     update_inventories();
     inventory_schedule_counter += 64;
   }
@@ -664,10 +715,66 @@ Game::update() {
   }
 #endif
 
-  update_flags();
-  update_buildings();
-  update_serfs();
-  update_game_stats();
+  {
+    TICK_PROFILE_PHASE(&tick_profile, PhaseFlags);
+    update_flags();
+  }
+  {
+    TICK_PROFILE_PHASE(&tick_profile, PhaseBuildings);
+    update_buildings();
+  }
+  {
+    TICK_PROFILE_PHASE(&tick_profile, PhaseSerfs);
+    update_serfs();
+  }
+  {
+    TICK_PROFILE_PHASE(&tick_profile, PhaseGameStats);
+    update_game_stats();
+  }
+}
+
+StateHashes
+Game::get_state_hashes() {
+  StateHashes hashes;
+  hashes.parts[StateHashes::PartMap] = map->get_state_hash();
+
+  StateHash serf_hash;
+  for (const Serf *serf : serfs) {
+    serf->hash_state(&serf_hash);
+  }
+  hashes.parts[StateHashes::PartSerfs] = serf_hash.get_value();
+
+  StateHash flag_hash;
+  for (const Flag *flag : flags) {
+    flag->hash_state(&flag_hash);
+  }
+  hashes.parts[StateHashes::PartFlags] = flag_hash.get_value();
+
+  StateHash building_hash;
+  for (const Building *building : buildings) {
+    building->hash_state(&building_hash);
+  }
+  hashes.parts[StateHashes::PartBuildings] = building_hash.get_value();
+
+  StateHash inventory_hash;
+  for (const Inventory *inventory : inventories) {
+    inventory->hash_state(&inventory_hash);
+  }
+  hashes.parts[StateHashes::PartInventories] = inventory_hash.get_value();
+
+  StateHash game_hash;
+  rnd.hash_state(&game_hash);
+  init_map_rnd.hash_state(&game_hash);
+  game_hash.add(tick);
+  game_hash.add(const_tick);
+  game_hash.add(gold_total);
+  game_hash.add(game_stats_counter);
+  game_hash.add(history_counter);
+  game_hash.add(static_cast<uint32_t>(knight_morale_counter));
+  game_hash.add(static_cast<uint32_t>(inventory_schedule_counter));
+  hashes.parts[StateHashes::PartGame] = game_hash.get_value();
+
+  return hashes;
 }
 
 /* Pause or unpause the game. */
@@ -895,8 +1002,8 @@ Game::building_remove_player_refs(Building *building) {
 
 bool
 Game::path_serf_idle_to_wait_state(MapPos pos) {
-  /* Look through serf array for the corresponding serf. */
-  for (Serf *serf : serfs) {
+  /* Look through serfs at pos for the corresponding serf. */
+  for (Serf *serf : get_serfs_at_pos(pos)) {
     if (serf->idle_to_wait_state(pos)) {
       return true;
     }
@@ -1030,7 +1137,7 @@ Game::build_flag_split_path(MapPos pos) {
 
   int select = -1;
   if (flag_2->serf_requested(dir_2)) {
-    for (Serf *serf : serfs) {
+    for (Serf *serf : get_road_bound_serfs()) {
       if (serf->path_splited(path_1_data.flag_index, path_1_data.flag_dir,
                              path_2_data.flag_index, path_2_data.flag_dir,
                              &select)) {
@@ -1585,7 +1692,7 @@ Game::demolish_flag_(MapPos pos) {
   flag->merge_paths(pos);
 
   /* Update serfs with reference to this flag. */
-  for (Serf *serf : serfs) {
+  for (Serf *serf : get_road_bound_serfs()) {
     serf->path_merged(flag);
   }
 
@@ -1982,8 +2089,17 @@ Game::add_player(unsigned int intelligence, unsigned int supplies,
 bool
 Game::init(unsigned int map_size, const Random &random) {
   init_map_rnd = random;
+  /* Seed the game from the map so that a seed reproduces the whole game */
+  rnd = random;
 
   map.reset(new Map(MapGeometry(map_size)));
+  serf_at_pos.clear();
+  player_objects_valid = false;
+  resource_demand_valid = false;
+  road_bound_serfs_valid = false;
+  idle_serfs_valid = false;
+  flag_routes.clear();
+  flag_components.clear();
   ClassicMissionMapGenerator generator(*map, init_map_rnd);
   generator.init();
   generator.generate();
@@ -2023,18 +2139,96 @@ Game::random_int() {
   return rnd.random();
 }
 
-int
+/* Each search gets a fresh generation. The counter is 64 bits wide so it
+   never wraps in practice and flags marked by older searches never have to
+   be cleared. */
+uint64_t
 Game::next_search_id() {
-  flag_search_counter += 1;
+  return ++flag_search_counter;
+}
+
+/* Generations start at one and skip zero, the generation of flags that
+   never searched. */
+static void
+next_generation(unsigned int *generation) {
+  *generation += 1;
+  if (*generation == 0) *generation = 1;
+}
+
+void
+Game::flag_roads_changed(Flag *flag) {
+  flag_routes.roads_changed(flag);
+  next_generation(&resource_inventory_generation);
+  next_generation(&serf_inventory_generation);
+}
 
-  /* If we're back at zero the counter has overflown,
-   everything needs a reset to be safe. */
-  if (flag_search_counter == 0) {
-    flag_search_counter += 1;
-    clear_search_id();
+/* Resources only travel on roads with transporters. */
+void
+Game::flag_transporters_changed() {
+  next_generation(&resource_inventory_generation);
+}
+
+void
+Game::flag_acceptance_changed() {
+  flag_components.clear();
+  next_generation(&resource_inventory_generation);
+  next_generation(&serf_inventory_generation);
+}
+
+int
+Game::get_resource_demand(unsigned int player, Resource::Type resource) {
+  if (!resource_demand_valid) init_resource_demand();
+  return resource_demand_max[player * requested_resource_types + resource];
+}
+
+void
+Game::resource_demand_changed(unsigned int owner, Resource::Type resource,
+                              int prio, int count) {
+  if (!resource_demand_valid || owner >= GAME_MAX_PLAYER_COUNT ||
+      resource < 0 || resource >= requested_resource_types ||
+      prio <= 0 || prio > 0xff) {
+    return;
   }
 
-  return flag_search_counter;
+  size_t index = owner * requested_resource_types + resource;
+  unsigned int *stocks = &resource_demand[index << 8];
+  int &max_prio = resource_demand_max[index];
+  stocks[prio] += count;
+  if (stocks[prio] != 0) {
+    max_prio = std::max(max_prio, prio);
+  } else if (prio == max_prio) {
+    while (max_prio > 0 && stocks[max_prio] == 0) max_prio -= 1;
+  }
+}
+
+void
+Game::init_resource_demand() {
+  resource_demand.assign(
+    (GAME_MAX_PLAYER_COUNT * requested_resource_types) << 8, 0);
+  resource_demand_max.assign(GAME_MAX_PLAYER_COUNT * requested_resource_types,
+                             0);
+  for (Building *building : buildings) {
+    building->update_demand();
+  }
+
+  resource_demand_valid = true;
+  for (Building *building : buildings) {
+    building->report_demand(1);
+  }
+}
+
+/* Swap an empty queue for one that already holds storage. */
+void
+Game::take_search_queue(std::vector<Flag*> *queue) {
+  if (search_queues.empty()) return;
+  queue->swap(search_queues.back());
+  search_queues.pop_back();
+}
+
+void
+Game::return_search_queue(std::vector<Flag*> *queue) {
+  queue->clear();
+  search_queues.push_back(std::move(*queue));
 }
 
 Serf *
@@ -2048,6 +2242,14 @@ Game::create_serf(int index) {
 
 void
 Game::delete_serf(Serf *serf) {
+  if (!serf_at_pos.empty()) {
+    remove_serf_from_pos_index(serf->get_index(), serf->get_pos());
+  }
+  if (player_objects_valid && serf->get_player() < GAME_MAX_PLAYER_COUNT) {
+    player_serfs[serf->get_player()].erase(serf->get_index());
+  }
+  road_bound_serfs.erase(serf->get_index());
+  remove_idle_serf(serf->get_index());
   serfs.erase(serf->get_index());
 }
 
@@ -2071,6 +2273,10 @@ Game::create_inventory(int index) {
 
 void
 Game::delete_inventory(Inventory *inventory) {
+  if (player_objects_valid &&
+      inventory->get_owner() < GAME_MAX_PLAYER_COUNT) {
+    player_inventories[inventory->get_owner()].erase(inventory->get_index());
+  }
   inventories.erase(inventory->get_index());
 }
 
@@ -2086,70 +2292,179 @@ Game::create_building(int index) {
 void
 Game::delete_building(Building *building) {
   map->set_object(building->get_position(), Map::ObjectNone, 0);
+  building->report_demand(-1);
+  if (player_objects_valid && building->get_owner() < GAME_MAX_PLAYER_COUNT) {
+    player_buildings[building->get_owner()].erase(building->get_index());
+  }
   buildings.erase(building->get_index());
 }
 
-Game::ListSerfs
+const Game::PlayerSerfs &
 Game::get_player_serfs(Player *player) {
-  ListSerfs player_serfs;
+  if (!player_objects_valid) init_player_objects();
+  return player_serfs[player->get_index()];
+}
 
-  for (Serf *serf : serfs) {
-    if (serf->get_player() == player->get_index()) {
-      player_serfs.push_back(serf);
-    }
-  }
+const Game::PlayerBuildings &
+Game::get_player_buildings(Player *player) {
+  if (!player_objects_valid) init_player_objects();
+  return player_buildings[player->get_index()];
+}
 
-  return player_serfs;
+const Game::PlayerInventories &
+Game::get_player_inventories(Player *player) {
+  if (!player_objects_valid) init_player_objects();
+  return player_inventories[player->get_index()];
 }
 
-Game::ListBuildings
-Game::get_player_buildings(Player *player) {
-  ListBuildings player_buildings;
+void
+Game::init_player_objects() {
+  for (unsigned int i = 0; i < GAME_MAX_PLAYER_COUNT; i++) {
+    player_serfs[i].clear();
+    player_buildings[i].clear();
+    player_inventories[i].clear();
+  }
 
+  for (Serf *serf : serfs) {
+    if (serf->get_player() < GAME_MAX_PLAYER_COUNT) {
+      player_serfs[serf->get_player()].insert(serf->get_index());
+    }
+  }
   for (Building *building : buildings) {
-    if (building->get_owner() == player->get_index()) {
-      player_buildings.push_back(building);
+    if (building->get_owner() < GAME_MAX_PLAYER_COUNT) {
+      player_buildings[building->get_owner()].insert(building->get_index());
+    }
+  }
+  for (Inventory *inventory : inventories) {
+    if (inventory->get_owner() < GAME_MAX_PLAYER_COUNT) {
+      player_inventories[inventory->get_owner()].insert(
+                                                       inventory->get_index());
     }
   }
 
-  return player_buildings;
+  player_objects_valid = true;
 }
 
-Game::ListInventories
-Game::get_player_inventories(Player *player) {
-  ListInventories player_inventories;
+void
+Game::serf_owner_changed(Serf *serf, unsigned int old_owner) {
+  if (!player_objects_valid) return;
+  if (old_owner < GAME_MAX_PLAYER_COUNT) {
+    player_serfs[old_owner].erase(serf->get_index());
+  }
+  if (serf->get_player() < GAME_MAX_PLAYER_COUNT) {
+    player_serfs[serf->get_player()].insert(serf->get_index());
+  }
+}
 
-  for (Inventory *inventory : inventories) {
-    if (inventory->get_owner() == player->get_index()) {
-      player_inventories.push_back(inventory);
-    }
+void
+Game::building_owner_changed(Building *building, unsigned int old_owner) {
+  if (!player_objects_valid) return;
+  if (old_owner < GAME_MAX_PLAYER_COUNT) {
+    player_buildings[old_owner].erase(building->get_index());
+  }
+  if (building->get_owner() < GAME_MAX_PLAYER_COUNT) {
+    player_buildings[building->get_owner()].insert(building->get_index());
   }
+}
 
-  return player_inventories;
+void
+Game::inventory_owner_changed(Inventory *inventory, unsigned int old_owner) {
+  if (!player_objects_valid) return;
+  if (old_owner < GAME_MAX_PLAYER_COUNT) {
+    player_inventories[old_owner].erase(inventory->get_index());
+  }
+  if (inventory->get_owner() < GAME_MAX_PLAYER_COUNT) {
+    player_inventories[inventory->get_owner()].insert(inventory->get_index());
+  }
 }
 
 Game::ListSerfs
 Game::get_serfs_at_pos(MapPos pos) {
-  ListSerfs result;
+  if (serf_at_pos.empty()) init_serf_pos_index();
+  if (pos >= serf_at_pos.size()) return ListSerfs();
 
+  std::vector<Serf*> found;
+  for (unsigned int i = serf_at_pos[pos]; i != 0; i = serf_pos_next[i]) {
+    found.push_back(serfs[i]);
+  }
+
+  /* Keep the order of a scan of all serfs. */
+  std::sort(found.begin(), found.end(), [](const Serf *a, const Serf *b) {
+    return a->get_index() < b->get_index();
+  });
+
+  return ListSerfs(found.begin(), found.end());
+}
+
+void
+Game::serf_pos_changed(Serf *serf, MapPos old_pos) {
+  if (serf_at_pos.empty()) return;
+  remove_serf_from_pos_index(serf->get_index(), old_pos);
+  add_serf_to_pos_index(serf->get_index(), serf->get_pos());
+}
+
+void
+Game::init_serf_pos_index() {
+  serf_at_pos.assign(map->geom().tile_count(), 0);
+  serf_pos_next.clear();
+  serf_pos_prev.clear();
   for (Serf *serf : serfs) {
-    if (serf->get_pos() == pos) {
-      result.push_back(serf);
-    }
+    add_serf_to_pos_index(serf->get_index(), serf->get_pos());
   }
+}
 
-  return result;
+void
+Game::add_serf_to_pos_index(unsigned int index, MapPos pos) {
+  /* Serf 0 is the NULL-serf and ends the lists. */
+  if (index == 0 || pos >= serf_at_pos.size()) return;
+
+  if (serf_pos_next.size() <= index) {
+    serf_pos_next.resize(index + 1, 0);
+    serf_pos_prev.resize(index + 1, 0);
+  }
+
+  unsigned int first = serf_at_pos[pos];
+  serf_pos_next[index] = first;
+  serf_pos_prev[index] = 0;
+  if (first != 0) serf_pos_prev[first] = index;
+  serf_at_pos[pos] = index;
+}
+
+void
+Game::remove_serf_from_pos_index(unsigned int index, MapPos pos) {
+  if (index == 0 || pos >= serf_at_pos.size()) return;
+
+  unsigned int next = serf_pos_next[index];
+  unsigned int prev = serf_pos_prev[index];
+  if (prev != 0) {
+    serf_pos_next[prev] = next;
+  } else {
+    serf_at_pos[pos] = next;
+  }
+  if (next != 0) serf_pos_prev[next] = prev;
 }
 
 Game::ListSerfs
 Game::get_serfs_in_inventory(Inventory *inventory) {
   ListSerfs result;
 
-  for (Serf *serf : serfs) {
-    if (serf->get_state() == Serf::StateIdleInStock &&
-        inventory->get_index() == serf->get_idle_in_stock_inv_index()) {
-      result.push_back(serf);
-    }
+  if (!idle_serfs_valid) init_idle_serfs();
+  for (const auto &key : idle_serfs[inventory->get_index()]) {
+    result.push_back(serfs[key.second]);
+  }
+
+  return result;
+}
+
+Game::ListSerfs
+Game::get_serfs_in_inventory(Inventory *inventory, Serf::Type type) {
+  ListSerfs result;
+
+  if (!idle_serfs_valid) init_idle_serfs();
+  const IdleSerfs &idle = idle_serfs[inventory->get_index()];
+  auto it = idle.lower_bound(std::make_pair(type, 0u));
+  for (; it != idle.end() && it->first == type; ++it) {
+    result.push_back(serfs[it->second]);
   }
 
   return result;
@@ -2159,7 +2474,7 @@ Game::ListSerfs
 Game::get_serfs_related_to(unsigned int dest, Direction dir) {
   ListSerfs result;
 
-  for (Serf *serf : serfs) {
+  for (Serf *serf : get_road_bound_serfs()) {
     if (serf->is_related_to(dest, dir)) {
       result.push_back(serf);
     }
@@ -2168,6 +2483,74 @@ Game::get_serfs_related_to(unsigned int dest, Direction dir) {
   return result;
 }
 
+const Game::Serfs::Subset &
+Game::get_road_bound_serfs() {
+  if (!road_bound_serfs_valid) {
+    road_bound_serfs.clear();
+    for (Serf *serf : serfs) {
+      if (serf->is_road_bound()) road_bound_serfs.insert(serf->get_index());
+    }
+    road_bound_serfs_valid = true;
+  }
+
+  return road_bound_serfs;
+}
+
+void
+Game::serf_state_changed(Serf *serf) {
+  update_idle_serf(serf);
+
+  if (!road_bound_serfs_valid) return;
+  if (serf->is_road_bound()) {
+    road_bound_serfs.insert(serf->get_index());
+  } else {
+    road_bound_serfs.erase(serf->get_index());
+  }
+}
+
+void
+Game::serf_type_changed(Serf *serf) {
+  update_idle_serf(serf);
+}
+
+void
+Game::init_idle_serfs() {
+  idle_serfs.clear();
+  idle_serf_keys.clear();
+  idle_serfs_valid = true;
+
+  for (Serf *serf : serfs) {
+    update_idle_serf(serf);
+  }
+}
+
+/* List serf under its current inventory and type if it is idle in stock. */
+void
+Game::update_idle_serf(Serf *serf) {
+  if (!idle_serfs_valid) return;
+
+  unsigned int index = serf->get_index();
+  remove_idle_serf(index);
+
+  if (serf->get_state() == Serf::StateIdleInStock) {
+    unsigned int inventory = serf->get_idle_in_stock_inv_index();
+    idle_serfs[inventory].insert(std::make_pair(serf->get_type(), index));
+    idle_serf_keys[index] = std::make_pair(inventory, serf->get_type());
+  }
+}
+
+void
+Game::remove_idle_serf(unsigned int index) {
+  if (!idle_serfs_valid) return;
+
+  auto it = idle_serf_keys.find(index);
+  if (it != idle_serf_keys.end()) {
+    idle_serfs[it->second.first].erase(std::make_pair(it->second.second,
+                                                      index));
+    idle_serf_keys.erase(it);
+  }
+}
+
 Player *
 Game::get_next_player(const Player *player) {
   auto p = players.begin();
@@ -2251,6 +2634,9 @@ operator >> (SaveReaderBinary &reader, Game &game) {
   reader >> r2;  // 86
   reader >> r3;  // 88
   game.rnd = Random(r1, r2, r3);
+  /* Not saved, derive it from the game random generator so that loading
+     the same game always gives the same map updates. */
+  game.init_map_rnd = game.rnd;
 
   reader >> v16;  // 90
   int max_flag_index = v16;
@@ -2342,6 +2728,18 @@ operator >> (SaveReaderBinary &reader, Game &game) {
 
   game.init_land_ownership();
 
+  /* Serf positions, owners and states were loaded directly */
+  game.serf_at_pos.clear();
+  game.player_objects_valid = false;
+  game.resource_demand_valid = false;
+  game.road_bound_serfs_valid = false;
+  game.idle_serfs_valid = false;
+  game.flag_routes.clear();
+  game.flag_components.clear();
+  /* Saved search marks are truncated, drop them so they can't collide with
+     the ids of new searches. */
+  game.clear_search_id();
+
   game.gold_total = game.map->get_gold_deposit();
 
   return reader;
@@ -2516,8 +2914,17 @@ operator >> (SaveReaderText &reader, Game &game) {
     ss >> r1 >> c >> r2 >> c >> r3;
     game.rnd = Random(r1, r2, r3);
   }
+  try {
+    game_reader->value("map_random") >> rnd_str;
+    game.init_map_rnd = Random(rnd_str);
+  } catch (...) {
+    /* Missing in saves of older versions */
+    game.init_map_rnd = game.rnd;
+  }
   game_reader->value("next_index") >> game.next_index;
-  game_reader->value("flag_search_counter") >> game.flag_search_counter;
+  unsigned int flag_search_counter;
+  game_reader->value("flag_search_counter") >> flag_search_counter;
+  game.flag_search_counter = flag_search_counter;
   for (int i = 0; i < 4; i++) {
     game_reader->value("player_history_index")[i] >>
                                                    game.player_history_index[i];
@@ -2615,6 +3022,18 @@ operator >> (SaveReaderText &reader, Game &game) {
 
   game.init_land_ownership();
 
+  /* Serf positions, owners and states were loaded directly */
+  game.serf_at_pos.clear();
+  game.player_objects_valid = false;
+  game.resource_demand_valid = false;
+  game.road_bound_serfs_valid = false;
+  game.idle_serfs_valid = false;
+  game.flag_routes.clear();
+  game.flag_components.clear();
+  /* Saved search marks are truncated, drop them so they can't collide with
+     the ids of new searches. */
+  game.clear_search_id();
+
   return reader;
 }
 
@@ -2626,9 +3045,11 @@ operator << (SaveWriterText &writer, Game &game) {
   writer.value("game_stats_counter") << game.game_stats_counter;
   writer.value("history_counter") << game.history_counter;
   writer.value("random") << (std::string)game.rnd;
+  writer.value("map_random") << (std::string)game.init_map_rnd;
 
   writer.value("next_index") << game.next_index;
-  writer.value("flag_search_counter") << game.flag_search_counter;
+  writer.value("flag_search_counter") <<
+    static_cast<unsigned int>(game.flag_search_counter);
 
   for (int i = 0; i < 4; i++) {
     writer.value("player_history_index") << game.player_history_index[i];
@@ -26,6 +26,8 @@
 #include <map>
 #include <string>
 #include <list>
+#include <set>
+#include <utility>
 #include <memory>
 
 #include "src/player.h"
@@ -35,6 +37,8 @@
 #include "src/map.h"
 #include "src/random.h"
 #include "src/objects.h"
+#include "src/state-hash.h"
+#include "src/tick-profile.h"
 
 #define DEFAULT_GAME_SPEED  2
 
@@ -57,6 +61,13 @@ class Game {
   typedef Collection<Serf> Serfs;
   typedef Collection<Player> Players;
 
+ public:
+  typedef Serfs::Subset PlayerSerfs;
+  typedef Buildings::Subset PlayerBuildings;
+  typedef Inventories::Subset PlayerInventories;
+
+ protected:
+
   PMap map;
 
   typedef std::map<unsigned int, unsigned int> Values;
@@ -79,7 +90,8 @@ class Game {
   unsigned int history_counter;
   Random rnd;
   uint16_t next_index;
-  uint16_t flag_search_counter;
+  /* Wide enough to never wrap, so search marks never need a reset. */
+  uint64_t flag_search_counter;
 
   uint16_t update_map_last_tick;
   int16_t update_map_counter;
@@ -102,6 +114,59 @@ class Game {
   int knight_morale_counter;
   int inventory_schedule_counter;
 
+  /* Serfs by position, built on first use. First serf at each map position
+     and links between the serfs at the same position (0 ends a list). */
+  std::vector<unsigned int> serf_at_pos;
+  std::vector<unsigned int> serf_pos_next;
+  std::vector<unsigned int> serf_pos_prev;
+
+  /* Objects of each player, built on first use and kept up to date
+     when objects change owner or are deleted. */
+  bool player_objects_valid;
+  std::vector<PlayerSerfs> player_serfs;
+  std::vector<PlayerBuildings> player_buildings;
+  std::vector<PlayerInventories> player_inventories;
+
+  /* Serfs heading for a road (see Serf::is_road_bound()), built on first
+     use and kept up to date on serf state changes. */
+  bool road_bound_serfs_valid;
+  Serfs::Subset road_bound_serfs;
+
+  /* Serfs idle in stock by inventory index, ordered by type. Built on
+     first use and kept up to date on serf state and type changes. Each
+     listed serf maps to the inventory and type it is listed under. */
+  typedef std::set<std::pair<Serf::Type, unsigned int>> IdleSerfs;
+  bool idle_serfs_valid;
+  std::map<unsigned int, IdleSerfs> idle_serfs;
+  std::map<unsigned int, std::pair<unsigned int, Serf::Type>> idle_serf_keys;
+
+  /* Walking directions between flags, kept up to date by the flags when
+     their roads change. */
+  FlagRoutes flag_routes;
+  FlagComponents flag_components;
+
+  /* Generations of the nearest inventory results cached by flags, one
+     for the search of resources and one for the search of serfs. */
+  unsigned int resource_inventory_generation;
+  unsigned int serf_inventory_generation;
+
+  /* Queues of finished flag searches, kept to be reused by the next
+     ones. Searches can run inside the callback of another search, so
+     each running search owns a queue. */
+  std::vector<std::vector<Flag*>> search_queues;
+
+  /* Stock priorities of the buildings of each player by resource type,
+     as the number of stocks with each priority (1 to 255) and the highest
+     priority with stocks. Built on first use and kept up to date by the
+     buildings. */
+  bool resource_demand_valid;
+  std::vector<unsigned int> resource_demand;
+  std::vector<int> resource_demand_max;
+
+#ifdef ENABLE_PROFILING
+  TickProfile tick_profile;
+#endif
+
  public:
   Game();
   virtual ~Game();
@@ -129,6 +194,15 @@ class Game {
   void speed_decrease();
   void speed_reset();
 
+#ifdef ENABLE_PROFILING
+  /* Timing of update phases */
+  const TickProfile &get_tick_profile() const { return tick_profile; }
+  void reset_tick_profile() { tick_profile.reset(); }
+#endif
+
+  /* Hashes of the game state, equal for games that ran identically. */
+  StateHashes get_state_hashes();
+
   void prepare_ground_analysis(MapPos pos, int estimates[5]);
   bool send_geologist(Flag *dest);
 
@@ -181,7 +255,25 @@ class Game {
     return player_history_index[scale]; }
   int get_resource_history_index() const { return resource_history_index; }
 
-  int next_search_id();
+  uint64_t next_search_id();
+  void take_search_queue(std::vector<Flag*> *queue);
+  void return_search_queue(std::vector<Flag*> *queue);
+  Direction get_walking_dir(Flag *src, unsigned int dest) {
+    return flag_routes.get_direction(src, dest); }
+  FlagComponents *get_flag_components() { return &flag_components; }
+  void flag_roads_changed(Flag *flag);
+  void flag_transporters_changed();
+  void flag_acceptance_changed();
+  unsigned int get_resource_inventory_generation() const {
+    return resource_inventory_generation; }
+  unsigned int get_serf_inventory_generation() const {
+    return serf_inventory_generation; }
+  /* Highest stock priority for resource in the buildings of player, or 0
+     if none of them requests it. */
+  int get_resource_demand(unsigned int player, Resource::Type resource);
+  /* Add (count 1) or remove (count -1) a stock priority of a building. */
+  void resource_demand_changed(unsigned int owner, Resource::Type resource,
+                               int prio, int count);
 
   Serf *create_serf(int index = -1);
   void delete_serf(Serf *serf);
@@ -197,13 +289,23 @@ class Game {
   Building *get_building(unsigned int index) { return buildings[index]; }
   Player *get_player(unsigned int index) { return players[index]; }
 
-  ListSerfs get_player_serfs(Player *player);
-  ListBuildings get_player_buildings(Player *player);
+  const PlayerSerfs &get_player_serfs(Player *player);
+  const PlayerBuildings &get_player_buildings(Player *player);
   ListSerfs get_serfs_in_inventory(Inventory *inventory);
+  ListSerfs get_serfs_in_inventory(Inventory *inventory, Serf::Type type);
   ListSerfs get_serfs_related_to(unsigned int dest, Direction dir);
-  ListInventories get_player_inventories(Player *player);
+  const PlayerInventories &get_player_inventories(Player *player);
+  /* Update the objects of each player after an owner changed. */
+  void serf_owner_changed(Serf *serf, unsigned int old_owner);
+  void building_owner_changed(Building *building, unsigned int old_owner);
+  void inventory_owner_changed(Inventory *inventory, unsigned int old_owner);
+  /* Update the serfs heading for a road after the state of serf changed. */
+  void serf_state_changed(Serf *serf);
+  void serf_type_changed(Serf *serf);
 
   ListSerfs get_serfs_at_pos(MapPos pos);
+  /* Update the serfs by position after the position of serf changed. */
+  void serf_pos_changed(Serf *serf, MapPos old_pos);
 
   Player *get_next_player(const Player *player);
   unsigned int get_enemy_score(const Player *player) const;
@@ -228,6 +330,15 @@ class Game {
   void flag_reset_transport(Flag *flag);
   void building_remove_player_refs(Building *building);
   bool path_serf_idle_to_wait_state(MapPos pos);
+  void init_serf_pos_index();
+  void init_player_objects();
+  void init_resource_demand();
+  const Serfs::Subset &get_road_bound_serfs();
+  void init_idle_serfs();
+  void update_idle_serf(Serf *serf);
+  void remove_idle_serf(unsigned int index);
+  void add_serf_to_pos_index(unsigned int index, MapPos pos);
+  void remove_serf_from_pos_index(unsigned int index, MapPos pos);
   void remove_road_forwards(MapPos pos, Direction dir);
   bool demolish_road_(MapPos pos);
   void build_flag_split_path(MapPos pos);
@@ -98,7 +98,8 @@ GuiObject::handle_event(const Event *event) {
   int event_y = event->y;
   if (event->type == Event::TypeClick ||
       event->type == Event::TypeDoubleClick ||
-      event->type == Event::TypeDrag) {
+      event->type == Event::TypeDrag ||
+      event->type == Event::TypeMove) {
     event_x = event->x - x;
     event_y = event->y - y;
     if (event_x < 0 || event_y < 0 || event_x > width || event_y > height) {
@@ -136,6 +137,9 @@ GuiObject::handle_event(const Event *event) {
     case Event::TypeDoubleClick:
       result = handle_dbl_click(event->x, event->y, event->button);
       break;
+    case Event::TypeMove:
+      result = handle_mouse_move(event_x, event_y);
+      break;
     case Event::TypeKeyPressed:
       result = handle_key_pressed(event->dx, event->dy);
       break;
@@ -323,7 +323,6 @@ void
 Interface::determine_map_cursor_type_road() {
   PMap map = game->get_map();
   MapPos pos = map_cursor_pos;
-  int h = map->get_height(pos);
   int valid_dir = 0;
 
   for (Direction d : cycle_directions_cw()) {
@@ -334,8 +333,7 @@ Interface::determine_map_cursor_type_road() {
       valid_dir |= BIT(d);
     } else if (map->is_road_segment_valid(pos, d)) {
       if (building_road.is_valid_extension(map.get(), d)) {
-        int h_diff = map->get_height(map->move(pos, d)) - h;
-        sprite = 39 + h_diff; /* height indicators */
+        sprite = 39 + map->get_slope(pos, d); /* height indicators */
         valid_dir |= BIT(d);
       } else {
         sprite = 44;
@@ -27,6 +27,7 @@
 #include "src/flag.h"
 #include "src/game.h"
 #include "src/serf.h"
+#include "src/state-hash.h"
 
 Inventory::Inventory(Game *game, unsigned int index)
   : GameObject(game, index) {
@@ -55,6 +56,15 @@ Inventory::~Inventory() {
   game->add_gold_total(-static_cast<int>(resources[Resource::TypeGoldOre]));
 }
 
+void
+Inventory::set_owner(unsigned int owner) {
+  unsigned int old_owner = this->owner;
+  this->owner = owner;
+  /* New inventories start out with the first player as owner, so they are
+     only registered here. */
+  game->inventory_owner_changed(this, old_owner);
+}
+
 void
 Inventory::push_resource(Resource::Type resource) {
   resources[resource] += (resources[resource] < 50000) ? 1 : 0;
@@ -406,6 +416,36 @@ Inventory::knight_training(Serf *serf, int p) {
   serf_idle_in_stock(serf);
 }
 
+void
+Inventory::hash_state(StateHash *hash) const {
+  hash->add(index);
+  hash->add(owner);
+  hash->add(flag);
+  hash->add(building);
+  hash->add(static_cast<uint32_t>(res_dir));
+
+  for (int i = 0; i < 2; i++) {
+    hash->add(static_cast<uint32_t>(out_queue[i].type));
+    hash->add(out_queue[i].dest);
+  }
+
+  hash->add(serfs_out);
+  hash->add(static_cast<uint32_t>(generic_count));
+
+  /* Empty entries are skipped as they may or may not be in the maps. */
+  for (const ResourceMap::value_type &res : resources) {
+    if (res.second == 0) continue;
+    hash->add(res.first);
+    hash->add(res.second);
+  }
+  hash->add(0xffffffff);
+  for (const Serf::SerfMap::value_type &serf : serfs) {
+    if (serf.second == 0) continue;
+    hash->add(serf.first);
+    hash->add(serf.second);
+  }
+}
+
 SaveReaderBinary&
 operator >> (SaveReaderBinary &reader, Inventory &inventory) {
   uint8_t byte;
@@ -30,6 +30,7 @@ class Flag;
 class SaveReaderBinary;
 class SaveReaderText;
 class SaveWriterText;
+class StateHash;
 
 class Inventory : public GameObject {
  public:
@@ -65,7 +66,7 @@ class Inventory : public GameObject {
   virtual ~Inventory();
 
   unsigned int get_owner() { return owner; }
-  void set_owner(unsigned int owner) { this->owner = owner; }
+  void set_owner(unsigned int owner);
 
   int get_flag_index() { return flag; }
   void set_flag_index(int flag_index) { flag = flag_index; }
@@ -126,6 +127,9 @@ class Inventory : public GameObject {
   void serf_idle_in_stock(Serf *serf);
   void knight_training(Serf *serf, int p);
 
+  /* Add the inventory state to hash. */
+  void hash_state(StateHash *hash) const;
+
   friend SaveReaderBinary&
     operator >> (SaveReaderBinary &reader, Inventory &inventory);
   friend SaveReaderText&
@@ -41,6 +41,7 @@ Log::Logger Log::Error(Log::LevelError, "Error");
 void
 Log::set_file(std::ostream *_stream) {
   stream = _stream;
+  set_level(level);
 }
 
 void
@@ -69,6 +69,7 @@
 #include <utility>
 
 #include "src/debug.h"
+#include "src/state-hash.h"
 #include "src/savegame.h"
 #include "src/map-generator.h"
 #include "src/map-geometry.h"
@@ -320,7 +321,8 @@ Map::map_space_from_obj[] = {
 
 Map::Map(const MapGeometry& geom)
   : geom_(geom)
-  , spiral_pos_pattern(new MapPos[295]) {
+  , spiral_pos_pattern(new MapPos[295])
+  , tiles_hash(0) {
   // Some code may still assume that map has at least size 3.
   if (geom.size() < 3) {
     throw ExceptionFreeserf("Failed to create map with size less than 3.");
@@ -328,6 +330,7 @@ Map::Map(const MapGeometry& geom)
 
   landscape_tiles.resize(geom_.tile_count());
   game_tiles.resize(geom_.tile_count());
+  slopes.resize(6 * geom_.tile_count());
 
   update_state.last_tick = 0;
   update_state.counter = 0;
@@ -340,6 +343,20 @@ Map::Map(const MapGeometry& geom)
   init_spiral_pos_pattern();
 }
 
+/* Copy the tiles of other, for example to read them on other threads.
+   The change handlers of other are not copied. */
+Map::Map(const Map& other)
+  : geom_(other.geom_)
+  , landscape_tiles(other.landscape_tiles)
+  , game_tiles(other.game_tiles)
+  , regions(other.regions)
+  , update_state(other.update_state)
+  , spiral_pos_pattern(new MapPos[295])
+  , slopes(other.slopes)
+  , tiles_hash(0) {
+  init_spiral_pos_pattern();
+}
+
 /* Return a random map position.
    Returned as map_pos_t and also as col and row if not NULL. */
 MapPos
@@ -381,12 +398,36 @@ Map::init_spiral_pos_pattern() {
 void
 Map::init_tiles(const MapGenerator &generator) {
   landscape_tiles = generator.get_landscape();
+  init_slopes();
+  reset_tile_hashes();
+}
+
+void
+Map::init_slopes() {
+  for (MapPos pos : geom_) {
+    for (Direction d : cycle_directions_cw()) {
+      slopes[6*pos + d] = get_height(move(pos, d)) - get_height(pos);
+    }
+  }
+}
+
+/* Update the slopes from pos and towards pos after its height changed. */
+void
+Map::update_slopes(MapPos pos) {
+  for (Direction d : cycle_directions_cw()) {
+    MapPos other_pos = move(pos, d);
+    int slope = get_height(other_pos) - get_height(pos);
+    slopes[6*pos + d] = slope;
+    slopes[6*other_pos + reverse_direction(d)] = -slope;
+  }
 }
 
 /* Change the height of a map position. */
 void
 Map::set_height(MapPos pos, int height) {
   landscape_tiles[pos].height = height;
+  update_slopes(pos);
+  update_tile_hash(pos);
 
   /* Mark landscape dirty */
   for (Direction d : cycle_directions_cw()) {
@@ -403,6 +444,7 @@ void
 Map::set_object(MapPos pos, Object obj, int index) {
   landscape_tiles[pos].obj = obj;
   if (index >= 0) game_tiles[pos].obj_index = index;
+  update_tile_hash(pos);
 
   /* Notify about object change */
   for (Direction d : cycle_directions_cw()) {
@@ -421,18 +463,21 @@ Map::remove_ground_deposit(MapPos pos, int amount) {
     /* Also sets the ground deposit type to none. */
     landscape_tiles[pos].mineral = MineralsNone;
   }
+  update_tile_hash(pos);
 }
 
 /* Remove fish at a map position (must be water). */
 void
 Map::remove_fish(MapPos pos, int amount) {
   landscape_tiles[pos].resource_amount -= amount;
+  update_tile_hash(pos);
 }
 
 /* Set the index of the serf occupying map position. */
 void
 Map::set_serf_index(MapPos pos, int index) {
   game_tiles[pos].serf = index;
+  update_tile_hash(pos);
 
   /* TODO Mark dirty in viewport. */
 }
@@ -525,7 +570,9 @@ Map::update_hidden(MapPos pos, Random *rnd) {
       /* Migrate a fish to adjacent water space. */
       landscape_tiles[pos].resource_amount -= 1;
       landscape_tiles[adj_pos].resource_amount += 1;
+      update_tile_hash(adj_pos);
     }
+    update_tile_hash(pos);
   }
 }
 
@@ -611,6 +658,8 @@ Map::place_road_segments(const Road &road) {
 
         game_tiles[pos_].paths &= ~BIT(dir);
         game_tiles[move(pos_, dir)].paths &= ~BIT(rev_dir);
+        paths_changed(pos_);
+        paths_changed(move(pos_, dir));
 
         pos_ = move(pos_, dir);
       }
@@ -620,6 +669,8 @@ Map::place_road_segments(const Road &road) {
 
     game_tiles[pos_].paths |= BIT(*it);
     game_tiles[move(pos_, *it)].paths |= BIT(rev_dir);
+    paths_changed(pos_);
+    paths_changed(move(pos_, *it));
 
     pos_ = move(pos_, *it);
   }
@@ -634,6 +685,7 @@ Map::remove_road_backref_until_flag(MapPos pos_, Direction dir) {
 
     /* Clear backreference */
     game_tiles[pos_].paths &= ~BIT(reverse_direction(dir));
+    paths_changed(pos_);
 
     if (get_obj(pos_) == ObjectFlag) break;
 
@@ -688,10 +740,12 @@ Direction
 Map::remove_road_segment(MapPos *pos, Direction dir) {
   /* Clear forward reference. */
   game_tiles[*pos].paths &= ~BIT(dir);
+  paths_changed(*pos);
   *pos = move(*pos, dir);
 
   /* Clear backreference. */
   game_tiles[*pos].paths &= ~BIT(reverse_direction(dir));
+  paths_changed(*pos);
 
   /* Find next direction of path. */
   dir = DirectionNone;
@@ -741,6 +795,44 @@ Map::road_segment_in_water(MapPos pos_, Direction dir) {
   return water;
 }
 
+uint64_t
+Map::compute_tile_hash(MapPos pos) const {
+  const LandscapeTile &landscape = landscape_tiles[pos];
+  const GameTile &tile = game_tiles[pos];
+
+  StateHash hash;
+  hash.add(pos);
+  hash.add(landscape.height);
+  hash.add((landscape.type_up << 8) | landscape.type_down);
+  hash.add((landscape.mineral << 8) | landscape.obj);
+  hash.add(static_cast<uint32_t>(landscape.resource_amount));
+  hash.add(tile.serf);
+  hash.add(tile.owner);
+  hash.add(tile.obj_index);
+  hash.add((tile.paths << 1) | (tile.idle_serf ? 1 : 0));
+  return hash.get_value();
+}
+
+uint64_t
+Map::get_state_hash() {
+  if (tile_hashes.empty()) {
+    tile_hashes.resize(geom_.tile_count());
+    tiles_hash = 0;
+    for (MapPos pos : geom_) {
+      tile_hashes[pos] = compute_tile_hash(pos);
+      tiles_hash ^= tile_hashes[pos];
+    }
+  }
+
+  StateHash hash;
+  hash.add(tiles_hash);
+  hash.add(static_cast<uint32_t>(update_state.remove_signs_counter));
+  hash.add(update_state.last_tick);
+  hash.add(static_cast<uint32_t>(update_state.counter));
+  hash.add(update_state.initial_pos);
+  return hash.get_value();
+}
+
 void
 Map::add_change_handler(Handler *handler) {
   change_handlers.push_back(handler);
@@ -846,6 +938,8 @@ operator >> (SaveReaderBinary &reader, Map &map) {
     }
   }
 
+  map.init_slopes();
+  map.reset_tile_hashes();
   return reader;
 }
 
@@ -909,6 +1003,8 @@ operator >> (SaveReaderText &reader, Map &map) {
     }
   }
 
+  map.init_slopes();
+  map.reset_tile_hashes();
   return reader;
 }
 
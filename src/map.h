@@ -231,6 +231,8 @@ class Map {
    public:
     virtual void on_height_changed(MapPos pos) = 0;
     virtual void on_object_changed(MapPos pos) = 0;
+    virtual void on_owner_changed(MapPos /*pos*/) {}
+    virtual void on_paths_changed(MapPos /*pos*/) {}
   };
 
   typedef struct LandscapeTile {
@@ -305,8 +307,18 @@ class Map {
 
   std::unique_ptr<MapPos[]> spiral_pos_pattern;
 
+  /* Height difference to the neighbour in each direction, six bytes per
+     tile, kept up to date by set_height(). */
+  std::vector<int8_t> slopes;
+
+  /* Hash of every tile and their combination, kept up to date by the
+     setters once get_state_hash() was called. */
+  std::vector<uint64_t> tile_hashes;
+  uint64_t tiles_hash;
+
  public:
   explicit Map(const MapGeometry& geom);
+  Map(const Map& other);
 
   const MapGeometry& geom() const { return geom_; }
 
@@ -365,18 +377,28 @@ class Map {
   bool has_path(MapPos pos, Direction dir) const {
     return (BIT_TEST(game_tiles[pos].paths, dir) != 0); }
   void add_path(MapPos pos, Direction dir) {
-    game_tiles[pos].paths |= BIT(dir); }
+    game_tiles[pos].paths |= BIT(dir);
+    paths_changed(pos); }
   void del_path(MapPos pos, Direction dir) {
-    game_tiles[pos].paths &= ~BIT(dir); }
+    game_tiles[pos].paths &= ~BIT(dir);
+    paths_changed(pos); }
 
   bool has_owner(MapPos pos) const { return (game_tiles[pos].owner != 0); }
   unsigned int get_owner(MapPos pos) const {
     return game_tiles[pos].owner - 1; }
   void set_owner(MapPos pos, unsigned int _owner) {
-    game_tiles[pos].owner = _owner + 1; }
-  void del_owner(MapPos pos) { game_tiles[pos].owner = 0; }
+    game_tiles[pos].owner = _owner + 1;
+    update_tile_hash(pos);
+    for (Handler *handler : change_handlers) handler->on_owner_changed(pos); }
+  void del_owner(MapPos pos) {
+    game_tiles[pos].owner = 0;
+    update_tile_hash(pos);
+    for (Handler *handler : change_handlers) handler->on_owner_changed(pos); }
   unsigned int get_height(MapPos pos) const {
     return landscape_tiles[pos].height; }
+  /* Height of the next position in direction dir minus height of pos. */
+  int get_slope(MapPos pos, Direction dir) const {
+    return slopes[6*pos + dir]; }
 
   Terrain type_up(MapPos pos) const { return landscape_tiles[pos].type_up; }
   Terrain type_down(MapPos pos) const { return landscape_tiles[pos].type_down; }
@@ -384,13 +406,18 @@ class Map {
 
   Object get_obj(MapPos pos) const { return landscape_tiles[pos].obj; }
   bool get_idle_serf(MapPos pos) const { return game_tiles[pos].idle_serf; }
-  void set_idle_serf(MapPos pos) { game_tiles[pos].idle_serf = true; }
-  void clear_idle_serf(MapPos pos) { game_tiles[pos].idle_serf = false; }
+  void set_idle_serf(MapPos pos) {
+    game_tiles[pos].idle_serf = true;
+    update_tile_hash(pos); }
+  void clear_idle_serf(MapPos pos) {
+    game_tiles[pos].idle_serf = false;
+    update_tile_hash(pos); }
 
   unsigned int get_obj_index(MapPos pos) const {
     return game_tiles[pos].obj_index; }
   void set_obj_index(MapPos pos, unsigned int index) {
-    game_tiles[pos].obj_index = index; }
+    game_tiles[pos].obj_index = index;
+    update_tile_hash(pos); }
   Minerals get_res_type(MapPos pos) const {
     return landscape_tiles[pos].mineral; }
   unsigned int get_res_amount(MapPos pos) const {
@@ -437,6 +464,9 @@ class Map {
     update_state = update_state_;
   }
 
+  /* Hash of all tiles and the update state. */
+  uint64_t get_state_hash();
+
   void add_change_handler(Handler *handler);
   void del_change_handler(Handler *handler);
 
@@ -464,9 +494,23 @@ class Map {
 
  protected:
   void init_spiral_pos_pattern();
+  void init_slopes();
+  void update_slopes(MapPos pos);
 
   void update_public(MapPos pos, Random *rnd);
   void update_hidden(MapPos pos, Random *rnd);
+
+  uint64_t compute_tile_hash(MapPos pos) const;
+  void update_tile_hash(MapPos pos) {
+    if (tile_hashes.empty()) return;
+    tiles_hash ^= tile_hashes[pos];
+    tile_hashes[pos] = compute_tile_hash(pos);
+    tiles_hash ^= tile_hashes[pos];
+  }
+  void reset_tile_hashes() { tile_hashes.clear(); }
+  void paths_changed(MapPos pos) {
+    update_tile_hash(pos);
+    for (Handler *handler : change_handlers) handler->on_paths_changed(pos); }
 };
 
 typedef std::shared_ptr<Map> PMap;
@@ -22,12 +22,16 @@
 #ifndef SRC_OBJECTS_H_
 #define SRC_OBJECTS_H_
 
-#include <map>
 #include <algorithm>
-#include <set>
-#include <memory>
+#include <cstdint>
+#include <functional>
 #include <limits>
+#include <memory>
+#include <new>
+#include <set>
+#include <type_traits>
 #include <utility>
+#include <vector>
 
 class Game;
 
@@ -50,116 +54,185 @@ class GameObject {
   unsigned int get_index() const { return index; }
 };
 
+/* Storage of game objects in blocks (slabs) of fixed size.
+
+   The storage of an object is determined by its index, so objects are packed
+   in index order and the storage of a freed index is reused by the next
+   object that gets the index. Blocks are only released by clear(). */
+template<class T>
+class ObjectPool {
+ public:
+  /* Number of objects in each block (about 16 KB per block). */
+  static const size_t objects_per_block =
+    (sizeof(T) < 16384) ? (16384 / sizeof(T)) : 1;
+
+ protected:
+  typedef typename std::aligned_storage<sizeof(T), alignof(T)>::type Storage;
+
+  std::vector<std::unique_ptr<Storage[]>> blocks;
+
+ public:
+  ObjectPool() {}
+  ObjectPool(const ObjectPool &that) = delete;
+  ObjectPool& operator = (const ObjectPool &that) = delete;
+
+  /* Construct object in the storage of index. */
+  T *create(Game *game, unsigned int index) {
+    size_t block = index / objects_per_block;
+    if (blocks.size() <= block) {
+      blocks.resize(block + 1);
+    }
+    if (!blocks[block]) {
+      blocks[block].reset(new Storage[objects_per_block]);
+    }
+    Storage *storage = &blocks[block][index % objects_per_block];
+    return new (storage) T(game, index);
+  }
+
+  /* Destroy object, its storage is kept for the index. */
+  void destroy(T *object) {
+    object->~T();
+  }
+
+  /* Release all storage. Objects must have been destroyed before. */
+  void clear() {
+    blocks.clear();
+  }
+};
+
+/* Collection of game objects addressed by index.
+
+   Objects are kept in a vector indexed by the object index (a slot map), so
+   lookup by index is a single array access and iteration visits the objects
+   in index order. Freed indexes are reused, lowest first. The objects
+   themselves live in an ObjectPool. */
 template<class T>
 class Collection {
  protected:
-  typedef std::map<unsigned int, T*> Objects;
+  typedef std::vector<T*> Objects;
 
   Objects objects;
-  unsigned int last_object_index;
-  std::set<unsigned int> free_object_indexes;
+  size_t count;
+  /* Min-heap of free indexes below objects.size(). It may contain indexes
+     that got occupied by get_or_insert(), these are skipped. */
+  std::vector<unsigned int> free_object_indexes;
+  ObjectPool<T> pool;
   Game *game;
 
  public:
   Collection() {
     game = NULL;
-    last_object_index = 0;
+    count = 0;
   }
 
   explicit Collection(Game *_game) {
     game = _game;
-    last_object_index = 0;
+    count = 0;
   }
 
   virtual ~Collection() {
     clear();
   }
 
+  Collection(const Collection &that) = delete;
+  Collection& operator = (const Collection &that) = delete;
+
   void clear() {
-    for (std::pair<const unsigned int, T*> &kv : objects) {
-      delete kv.second;
+    for (T *object : objects) {
+      if (object != nullptr) pool.destroy(object);
     }
+    pool.clear();
     objects.clear();
+    free_object_indexes.clear();
+    count = 0;
   }
 
   T*
   allocate() {
     unsigned int new_index = 0;
 
+    while (!free_object_indexes.empty() &&
+           exists(free_object_indexes.front())) {
+      pop_free_index();
+    }
+
     if (!free_object_indexes.empty()) {
-      new_index = *free_object_indexes.begin();
-      free_object_indexes.erase(free_object_indexes.begin());
+      new_index = pop_free_index();
     } else {
-      if (last_object_index ==
-          std::numeric_limits<decltype(last_object_index)>::max()) {
+      if (objects.size() ==
+          std::numeric_limits<unsigned int>::max()) {
         return nullptr;
       }
 
-      new_index = last_object_index;
-      last_object_index++;
+      new_index = static_cast<unsigned int>(objects.size());
+      objects.push_back(nullptr);
     }
 
-    T *new_object = new T(game, new_index);
+    T *new_object = pool.create(game, new_index);
     objects[new_index] = new_object;
+    count++;
 
     return new_object;
   }
 
   bool
   exists(unsigned int index) const {
-    return (objects.end() != objects.find(index));
+    return (index < objects.size() && objects[index] != nullptr);
   }
 
   T*
   get_or_insert(unsigned int index) {
-    if (!exists(index)) {
-      T *new_object = new T(game, index);
-      objects[index] = new_object;
-
-      std::set<unsigned int>::iterator i = free_object_indexes.find(index);
-      if (i != free_object_indexes.end()) {
-        free_object_indexes.erase(i);
+    if (objects.size() <= index) {
+      for (size_t i = objects.size(); i < index; i++) {
+        push_free_index(static_cast<unsigned int>(i));
       }
+      objects.resize(index + 1, nullptr);
     }
 
-    if (last_object_index <= index) {
-      for (unsigned int i = last_object_index; i < index; i++) {
-        free_object_indexes.insert(index);
-      }
-      last_object_index = index + 1;
+    if (objects[index] == nullptr) {
+      objects[index] = pool.create(game, index);
+      count++;
     }
 
-    return objects.at(index);
+    return objects[index];
   }
 
   T* operator[] (unsigned int index) {
     if (!exists(index)) return nullptr;
-    return objects.at(index);
+    return objects[index];
   }
 
   const T* operator[] (unsigned int index) const {
     if (!exists(index)) return nullptr;
-    return objects.at(index);
+    return objects[index];
   }
 
+  /* Iterators go by index, so objects may be added or erased while
+     iterating, as long as the current one is not erased before advancing. */
   class Iterator {
    protected:
-    typename Objects::iterator internal_iterator;
+    const Objects *objects;
+    size_t index;
 
    public:
-    explicit Iterator(typename Objects::iterator internal_iterator) {
-      this->internal_iterator = internal_iterator;
+    Iterator(const Objects *objects, size_t index)
+      : objects(objects), index(index) {
+      skip_free();
     }
 
     Iterator&
     operator++() {
-      internal_iterator++;
+      index++;
+      skip_free();
       return (*this);
     }
 
     bool
     operator==(const Iterator& right) const {
-      return (internal_iterator == right.internal_iterator);
+      bool at_end = (index >= objects->size());
+      bool right_at_end = (right.index >= right.objects->size());
+      if (at_end || right_at_end) return (at_end == right_at_end);
+      return (index == right.index);
     }
 
     bool
@@ -168,64 +241,120 @@ class Collection {
     }
 
     T* operator*() const {
-      return internal_iterator->second;
+      return (*objects)[index];
     }
-  };
 
-  class ConstIterator {
    protected:
-    typename Objects::const_iterator internal_iterator;
+    void skip_free() {
+      while (index < objects->size() && (*objects)[index] == nullptr) {
+        index++;
+      }
+    }
+  };
 
+  class ConstIterator : public Iterator {
    public:
-    explicit ConstIterator(typename Objects::const_iterator it) {
-     this->internal_iterator = it;
-    }
+    ConstIterator(const Objects *objects, size_t index)
+      : Iterator(objects, index) {}
 
     ConstIterator& operator++() {
-     internal_iterator++;
-     return (*this);
-    }
-
-    bool operator == (const ConstIterator& right) const {
-     return internal_iterator == right.internal_iterator;
-    }
-
-    bool operator != (const ConstIterator& right) const {
-     return !(*this == right);
+      Iterator::operator++();
+      return (*this);
     }
 
     const T* operator*() const {
-     return internal_iterator->second;
+      return Iterator::operator*();
     }
   };
 
-  Iterator begin() { return Iterator(objects.begin()); }
-  Iterator end() { return Iterator(objects.end()); }
+  /* Any iterator past the last slot equals end(), so objects added while
+     iterating are visited as well. */
+  Iterator begin() { return Iterator(&objects, 0); }
+  Iterator end() { return Iterator(&objects, SIZE_MAX); }
 
-  ConstIterator begin() const { return ConstIterator(objects.begin()); }
-  ConstIterator end() const { return ConstIterator(objects.end()); }
+  ConstIterator begin() const { return ConstIterator(&objects, 0); }
+  ConstIterator end() const { return ConstIterator(&objects, SIZE_MAX); }
 
   void
   erase(unsigned int index) {
-    /* Decrement max_flag_index as much as possible. */
-    typename Objects::iterator i = objects.find(index);
-    if (i == objects.end()) {
+    if (!exists(index)) {
       return;
     }
     T *object_for_deleting = objects[index];
-    objects.erase(i);
-    delete object_for_deleting;
+    objects[index] = nullptr;
+    count--;
+    pool.destroy(object_for_deleting);
 
-    if (index == last_object_index) {
-      last_object_index--;
-      // ToDo: remove all empty indexes if needed
-    } else {
-      free_object_indexes.insert(index);
-    }
+    push_free_index(index);
   }
 
   size_t
-  size() const { return objects.size(); }
+  size() const { return count; }
+
+  /* Subset of the objects of a collection (e.g. those of one player),
+     iterated in index order like the collection itself. */
+  class Subset {
+   protected:
+    typedef std::set<unsigned int> Indexes;
+
+    Collection *collection;
+    Indexes indexes;
+
+   public:
+    explicit Subset(Collection *collection) : collection(collection) {}
+
+    void insert(unsigned int index) { indexes.insert(index); }
+    void erase(unsigned int index) { indexes.erase(index); }
+    void clear() { indexes.clear(); }
+
+    size_t size() const { return indexes.size(); }
+    bool empty() const { return indexes.empty(); }
+
+    class Iterator {
+     protected:
+      Collection *collection;
+      Indexes::const_iterator internal_iterator;
+
+     public:
+      Iterator(Collection *collection, Indexes::const_iterator it)
+        : collection(collection), internal_iterator(it) {}
+
+      Iterator& operator++() {
+        ++internal_iterator;
+        return (*this);
+      }
+
+      bool operator == (const Iterator& right) const {
+        return (internal_iterator == right.internal_iterator);
+      }
+
+      bool operator != (const Iterator& right) const {
+        return !(*this == right);
+      }
+
+      T* operator*() const {
+        return collection->objects[*internal_iterator];
+      }
+    };
+
+    Iterator begin() const { return Iterator(collection, indexes.begin()); }
+    Iterator end() const { return Iterator(collection, indexes.end()); }
+  };
+
+ protected:
+  void push_free_index(unsigned int index) {
+    free_object_indexes.push_back(index);
+    std::push_heap(free_object_indexes.begin(), free_object_indexes.end(),
+                   std::greater<unsigned int>());
+  }
+
+  unsigned int pop_free_index() {
+    std::pop_heap(free_object_indexes.begin(), free_object_indexes.end(),
+                  std::greater<unsigned int>());
+    unsigned int index = free_object_indexes.back();
+    free_object_indexes.pop_back();
+    return index;
+  }
 };
 
 #endif  // SRC_OBJECTS_H_
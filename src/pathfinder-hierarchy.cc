@@ -0,0 +1,479 @@
+/*
+ * pathfinder-hierarchy.cc - Hierarchical road search for long distances
+ *
+ * Copyright (C) 2018  Wicked_Digger <wicked_digger@mail.ru>
+ *
+ * This file is part of freeserf.
+ *
+ * freeserf is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * freeserf is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with freeserf.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "src/pathfinder-hierarchy.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <functional>
+#include <limits>
+#include <queue>
+#include <unordered_map>
+#include <utility>
+
+static const unsigned int no_cost = std::numeric_limits<unsigned int>::max();
+
+/* Clusters owning the left, upper and upper left border of a cluster. */
+static const int border_owners[][2] = { { -1, 0 }, { 0, -1 }, { -1, -1 } };
+
+typedef std::pair<unsigned int, MapPos> QueueItem;
+typedef std::priority_queue<QueueItem, std::vector<QueueItem>,
+                            std::greater<QueueItem>> Queue;
+
+HierarchicalPathfinder::HierarchicalPathfinder(PMap map)
+  : map(map) {
+  cols = map->get_cols() / cluster_size;
+  rows = map->get_rows() / cluster_size;
+  clusters.resize(cols * rows);
+  for (unsigned int i = 0; i < clusters.size(); i++) {
+    clusters[i].dirty = false;
+    set_dirty(i);
+  }
+
+  map->add_change_handler(this);
+}
+
+HierarchicalPathfinder::~HierarchicalPathfinder() {
+  map->del_change_handler(this);
+}
+
+unsigned int
+HierarchicalPathfinder::get_cluster(MapPos pos) const {
+  return (map->pos_row(pos) / cluster_size) * cols +
+         map->pos_col(pos) / cluster_size;
+}
+
+unsigned int
+HierarchicalPathfinder::get_neighbour(unsigned int cluster,
+                                      int dx, int dy) const {
+  unsigned int col = (cluster % cols + cols + dx) % cols;
+  unsigned int row = (cluster / cols + rows + dy) % rows;
+  return row * cols + col;
+}
+
+MapPos
+HierarchicalPathfinder::get_origin(unsigned int cluster) const {
+  return map->pos((cluster % cols) * cluster_size,
+                  (cluster / cols) * cluster_size);
+}
+
+unsigned int
+HierarchicalPathfinder::get_local_index(unsigned int cluster,
+                                        MapPos pos) const {
+  MapPos origin = get_origin(cluster);
+  return (map->pos_row(pos) - map->pos_row(origin)) * cluster_size +
+         (map->pos_col(pos) - map->pos_col(origin));
+}
+
+void
+HierarchicalPathfinder::set_dirty(unsigned int cluster) {
+  if (clusters[cluster].dirty) return;
+  clusters[cluster].dirty = true;
+  dirty_clusters.push_back(cluster);
+}
+
+void
+HierarchicalPathfinder::on_height_changed(MapPos pos) {
+  set_dirty(get_cluster(pos));
+}
+
+void
+HierarchicalPathfinder::on_object_changed(MapPos pos) {
+  set_dirty(get_cluster(pos));
+}
+
+void
+HierarchicalPathfinder::on_owner_changed(MapPos pos) {
+  set_dirty(get_cluster(pos));
+}
+
+void
+HierarchicalPathfinder::on_paths_changed(MapPos pos) {
+  set_dirty(get_cluster(pos));
+}
+
+/* Find a road from start to end, or return an invalid road if there is
+   none or it would be too long to build. */
+Road
+HierarchicalPathfinder::find_road(MapPos start, MapPos end) {
+  if (std::abs(map->dist_x(start, end)) < 2 * cluster_size &&
+      std::abs(map->dist_y(start, end)) < 2 * cluster_size) {
+    return pathfinder.find_road(map.get(), start, end);
+  }
+
+  /* A failed step means the map changed in ways that were not reported,
+     rebuild the clusters passed and try once more. */
+  for (int attempt = 0; attempt < 2; attempt++) {
+    update_clusters();
+
+    std::vector<MapPos> waypoints;
+    if (!find_waypoints(start, end, &waypoints)) return Road();
+
+    Road road;
+    road.start(start);
+    MapPos pos = start;
+    size_t i = 1;
+    for (; i < waypoints.size(); i++) {
+      if (road.has_pos(map.get(), waypoints[i])) {
+        /* An earlier step passed the waypoint already, cut the loop. */
+        Road cut;
+        cut.start(start);
+        for (Direction dir : road.get_dirs()) {
+          if (cut.get_end(map.get()) == waypoints[i]) break;
+          cut.extend(dir);
+        }
+        road = cut;
+        pos = waypoints[i];
+        continue;
+      }
+
+      Road step = pathfinder.find_road(map.get(), pos, waypoints[i], &road);
+      if (!step.is_valid()) break;
+      for (Direction dir : step.get_dirs()) {
+        if (!road.is_extendable()) return Road();
+        road.extend(dir);
+      }
+      pos = waypoints[i];
+    }
+    if (i == waypoints.size()) return road;
+
+    set_dirty(get_cluster(pos));
+    set_dirty(get_cluster(waypoints[i]));
+  }
+
+  return pathfinder.find_road(map.get(), start, end);
+}
+
+/* Rebuild the dirty clusters. A cluster owns the crossings of its right,
+   lower and lower right border, so the crossings of the clusters to the
+   left and above change too, and with them the entrances of all
+   neighbours. */
+void
+HierarchicalPathfinder::update_clusters() {
+  if (dirty_clusters.empty()) return;
+
+  static const int owners[][2] = {
+    { 0, 0 }, { -1, 0 }, { 0, -1 }, { -1, -1 }
+  };
+  static const int neighbours[][2] = {
+    { 0, 0 }, { 1, 0 }, { 0, 1 }, { 1, 1 }, { -1, 0 }, { 0, -1 }, { -1, -1 }
+  };
+
+  std::vector<bool> crossings_done(clusters.size(), false);
+  std::vector<bool> entrances_done(clusters.size(), false);
+  for (unsigned int cluster : dirty_clusters) {
+    for (const int *d : owners) {
+      unsigned int owner = get_neighbour(cluster, d[0], d[1]);
+      if (!crossings_done[owner]) {
+        build_crossings(owner);
+        crossings_done[owner] = true;
+      }
+    }
+  }
+
+  for (unsigned int cluster : dirty_clusters) {
+    for (const int *d : neighbours) {
+      unsigned int neighbour = get_neighbour(cluster, d[0], d[1]);
+      if (!entrances_done[neighbour]) {
+        build_entrances(neighbour);
+        entrances_done[neighbour] = true;
+      }
+    }
+    clusters[cluster].dirty = false;
+  }
+
+  dirty_clusters.clear();
+}
+
+/* Whether a road can pass through pos. */
+bool
+HierarchicalPathfinder::is_transit(MapPos pos) const {
+  Map::Object obj = map->get_obj(pos);
+  return map->paths(pos) == 0 && obj != Map::ObjectFlag &&
+         Map::map_space_from_obj[obj] < Map::SpaceSemipassable &&
+         map->has_owner(pos);
+}
+
+/* Whether a road can pass through pos and the next position in dir. */
+bool
+HierarchicalPathfinder::can_cross(MapPos pos, Direction dir) const {
+  MapPos other_pos = map->move(pos, dir);
+  return is_transit(pos) && is_transit(other_pos) &&
+         map->is_road_segment_valid(other_pos, reverse_direction(dir));
+}
+
+/* Add an entrance for each run of border positions where a road can
+   cross. The border starts at first and goes on in direction along, at
+   each position a road crosses in direction dir or alt_dir (except at the
+   last position, where alt_dir leads to another cluster). */
+void
+HierarchicalPathfinder::add_crossings(unsigned int cluster, MapPos first,
+                                      Direction along, Direction dir,
+                                      Direction alt_dir) {
+  Cluster &c = clusters[cluster];
+  std::vector<Direction> slots;
+  MapPos pos = first;
+  for (unsigned int i = 0; i <= cluster_size; i++) {
+    Direction slot = DirectionNone;
+    if (i < cluster_size) {
+      if (can_cross(pos, dir)) {
+        slot = dir;
+      } else if (i + 1 < cluster_size && can_cross(pos, alt_dir)) {
+        slot = alt_dir;
+      }
+    }
+
+    if (slot != DirectionNone) {
+      slots.push_back(slot);
+    } else if (!slots.empty()) {
+      /* End of a run, cross at its middle. */
+      size_t middle = slots.size() / 2;
+      Crossing crossing;
+      crossing.from = first;
+      for (unsigned int j = 0; j < i - slots.size() + middle; j++) {
+        crossing.from = map->move(crossing.from, along);
+      }
+      crossing.dir = slots[middle];
+      crossing.to = map->move(crossing.from, crossing.dir);
+      c.crossings.push_back(crossing);
+      slots.clear();
+    }
+
+    pos = map->move(pos, along);
+  }
+}
+
+void
+HierarchicalPathfinder::build_crossings(unsigned int cluster) {
+  Cluster &c = clusters[cluster];
+  c.crossings.clear();
+
+  MapPos origin = get_origin(cluster);
+  MapPos right = map->move_right_n(origin, cluster_size - 1);
+  MapPos bottom = map->move_down_n(origin, cluster_size - 1);
+  MapPos corner = map->move_right_n(bottom, cluster_size - 1);
+
+  add_crossings(cluster, right, DirectionDown, DirectionRight,
+                DirectionDownRight);
+  add_crossings(cluster, bottom, DirectionRight, DirectionDown,
+                DirectionDownRight);
+  if (can_cross(corner, DirectionDownRight)) {
+    Crossing crossing;
+    crossing.from = corner;
+    crossing.dir = DirectionDownRight;
+    crossing.to = map->move_down_right(corner);
+    c.crossings.push_back(crossing);
+  }
+}
+
+/* Collect the entrances of cluster from the crossings of its borders and
+   compute the walking costs between them. */
+void
+HierarchicalPathfinder::build_entrances(unsigned int cluster) {
+  Cluster &c = clusters[cluster];
+  c.entrances.clear();
+
+  for (const Crossing &crossing : c.crossings) {
+    c.entrances.push_back(crossing.from);
+  }
+  for (const int *d : border_owners) {
+    for (const Crossing &crossing :
+           clusters[get_neighbour(cluster, d[0], d[1])].crossings) {
+      if (get_cluster(crossing.to) == cluster) {
+        c.entrances.push_back(crossing.to);
+      }
+    }
+  }
+  std::sort(c.entrances.begin(), c.entrances.end());
+  c.entrances.erase(std::unique(c.entrances.begin(), c.entrances.end()),
+                    c.entrances.end());
+
+  size_t count = c.entrances.size();
+  c.costs.assign(count * count, no_cost);
+  std::vector<unsigned int> costs;
+  for (size_t i = 0; i < count; i++) {
+    search_cluster(c.entrances[i], false, &costs);
+    for (size_t j = 0; j < count; j++) {
+      c.costs[i * count + j] = costs[get_local_index(cluster,
+                                                     c.entrances[j])];
+    }
+  }
+}
+
+/* Walking costs of roads from source to the positions of its cluster
+   (indexed by get_local_index()), or from the positions to source if
+   to_source is set. Roads only pass positions where is_transit() holds;
+   source itself is only checked as RoadPathfinder does. */
+void
+HierarchicalPathfinder::search_cluster(MapPos source, bool to_source,
+                                       std::vector<unsigned int> *costs)
+                                                                      const {
+  unsigned int cluster = get_cluster(source);
+  costs->assign(cluster_size * cluster_size, no_cost);
+
+  Queue queue;
+  (*costs)[get_local_index(cluster, source)] = 0;
+  queue.push(QueueItem(0, source));
+  while (!queue.empty()) {
+    QueueItem item = queue.top();
+    queue.pop();
+    MapPos pos = item.second;
+    if (item.first != (*costs)[get_local_index(cluster, pos)]) continue;
+
+    for (Direction d : cycle_directions_cw()) {
+      MapPos new_pos = map->move(pos, d);
+      if (get_cluster(new_pos) != cluster || !is_transit(new_pos)) continue;
+
+      /* RoadPathfinder checks the segment from the position nearer to
+         the end of the road. */
+      bool valid = to_source ? map->is_road_segment_valid(pos, d) :
+                       map->is_road_segment_valid(new_pos,
+                                                  reverse_direction(d));
+      if (!valid) continue;
+
+      unsigned int cost = item.first + road_segment_cost(map.get(), pos, d);
+      unsigned int &new_cost = (*costs)[get_local_index(cluster, new_pos)];
+      if (cost < new_cost) {
+        new_cost = cost;
+        queue.push(QueueItem(cost, new_pos));
+      }
+    }
+  }
+}
+
+/* Whether the result of search_cluster() reaches an entrance. */
+bool
+HierarchicalPathfinder::reaches_entrance(
+                               unsigned int cluster,
+                               const std::vector<unsigned int> &costs) const {
+  for (MapPos entrance : clusters[cluster].entrances) {
+    if (costs[get_local_index(cluster, entrance)] != no_cost) return true;
+  }
+  return false;
+}
+
+/* Search the graph of entrances for the points a road from start to end
+   passes. The first waypoint is start, the last is end. */
+bool
+HierarchicalPathfinder::find_waypoints(MapPos start, MapPos end,
+                                       std::vector<MapPos> *waypoints) {
+  unsigned int start_cluster = get_cluster(start);
+  unsigned int end_cluster = get_cluster(end);
+  std::vector<unsigned int> start_costs;
+  std::vector<unsigned int> end_costs;
+  search_cluster(start, false, &start_costs);
+  search_cluster(end, true, &end_costs);
+  if (!reaches_entrance(start_cluster, start_costs) ||
+      !reaches_entrance(end_cluster, end_costs)) {
+    return false;
+  }
+
+  class Node {
+   public:
+    unsigned int g_score;
+    MapPos parent;
+    bool closed;
+  };
+  std::unordered_map<MapPos, Node> nodes;
+  Queue open;
+
+  auto reach = [&](MapPos pos, MapPos parent, unsigned int g_score) {
+    auto it = nodes.find(pos);
+    if (it == nodes.end()) {
+      it = nodes.insert(std::make_pair(pos, Node{no_cost, 0, false})).first;
+    }
+    if (it->second.closed || g_score >= it->second.g_score) return;
+    it->second.g_score = g_score;
+    it->second.parent = parent;
+    open.push(QueueItem(g_score + road_cost_estimate(map.get(), pos, end),
+                        pos));
+  };
+
+  nodes[start] = Node{0, start, false};
+  open.push(QueueItem(0, start));
+  while (!open.empty()) {
+    MapPos pos = open.top().second;
+    open.pop();
+    Node &node = nodes[pos];
+    if (node.closed) continue;
+    node.closed = true;
+    unsigned int g_score = node.g_score;
+
+    if (pos == end) {
+      waypoints->clear();
+      while (pos != start) {
+        waypoints->push_back(pos);
+        pos = nodes[pos].parent;
+      }
+      waypoints->push_back(start);
+      std::reverse(waypoints->begin(), waypoints->end());
+      return true;
+    }
+
+    if (pos == start) {
+      const Cluster &c = clusters[start_cluster];
+      for (MapPos entrance : c.entrances) {
+        unsigned int cost = start_costs[get_local_index(start_cluster,
+                                                        entrance)];
+        if (cost != no_cost) reach(entrance, pos, g_score + cost);
+      }
+      continue;
+    }
+
+    /* Entrance: other entrances of its cluster, the end, and across the
+       borders. */
+    unsigned int cluster = get_cluster(pos);
+    const Cluster &c = clusters[cluster];
+    size_t count = c.entrances.size();
+    size_t index = std::lower_bound(c.entrances.begin(), c.entrances.end(),
+                                    pos) - c.entrances.begin();
+    for (size_t j = 0; j < count; j++) {
+      unsigned int cost = c.costs[index * count + j];
+      if (j != index && cost != no_cost) {
+        reach(c.entrances[j], pos, g_score + cost);
+      }
+    }
+
+    if (cluster == end_cluster) {
+      unsigned int cost = end_costs[get_local_index(end_cluster, pos)];
+      if (cost != no_cost) reach(end, pos, g_score + cost);
+    }
+
+    for (const Crossing &crossing : c.crossings) {
+      if (crossing.from == pos) {
+        reach(crossing.to, pos,
+              g_score + road_segment_cost(map.get(), pos, crossing.dir));
+      }
+    }
+    for (const int *d : border_owners) {
+      for (const Crossing &crossing :
+             clusters[get_neighbour(cluster, d[0], d[1])].crossings) {
+        if (crossing.to == pos) {
+          reach(crossing.from, pos,
+                g_score + road_segment_cost(map.get(), pos,
+                                            reverse_direction(crossing.dir)));
+        }
+      }
+    }
+  }
+
+  return false;
+}
@@ -0,0 +1,107 @@
+/*
+ * pathfinder-hierarchy.h - Hierarchical road search for long distances
+ *
+ * Copyright (C) 2018  Wicked_Digger <wicked_digger@mail.ru>
+ *
+ * This file is part of freeserf.
+ *
+ * freeserf is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * freeserf is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with freeserf.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SRC_PATHFINDER_HIERARCHY_H_
+#define SRC_PATHFINDER_HIERARCHY_H_
+
+#include <vector>
+
+#include "src/map.h"
+#include "src/pathfinder.h"
+
+/* Road search over clusters of the map for long distances (HPA*).
+
+   The map is divided into square clusters. Along each cluster border, the
+   middle of every run of positions where a road can cross the border
+   becomes an entrance, and the walking costs between the entrances of a
+   cluster are computed with the height rules of RoadPathfinder. A long
+   query searches the graph of entrances first, then builds the road step
+   by step between the entrances found with a RoadPathfinder, so the road
+   follows the same rules as a direct search. The road is valid but can
+   cost a bit more than the cheapest one.
+
+   Clusters the map reports changes in are rebuilt on the next query,
+   together with the borders and entrances they share with neighbours.
+   Short queries go to the RoadPathfinder directly. */
+class HierarchicalPathfinder : public Map::Handler {
+ public:
+  static const unsigned int cluster_size = 16;
+
+ protected:
+  class Crossing {
+   public:
+    MapPos from;  /* Entrance in the cluster owning the border */
+    MapPos to;  /* Entrance in the right, lower or lower right cluster */
+    Direction dir;  /* Direction from the first to the second */
+  };
+
+  class Cluster {
+   public:
+    bool dirty;
+    std::vector<Crossing> crossings;
+    /* Entrances sorted by position and the walking costs between them,
+       row by row. */
+    std::vector<MapPos> entrances;
+    std::vector<unsigned int> costs;
+  };
+
+  PMap map;
+  RoadPathfinder pathfinder;
+  unsigned int cols;  /* Clusters in a row of the map */
+  unsigned int rows;  /* Rows of clusters */
+  std::vector<Cluster> clusters;
+  std::vector<unsigned int> dirty_clusters;
+
+ public:
+  explicit HierarchicalPathfinder(PMap map);
+  virtual ~HierarchicalPathfinder();
+
+  Road find_road(MapPos start, MapPos end);
+
+  virtual void on_height_changed(MapPos pos);
+  virtual void on_object_changed(MapPos pos);
+  virtual void on_owner_changed(MapPos pos);
+  virtual void on_paths_changed(MapPos pos);
+
+ protected:
+  unsigned int get_cluster(MapPos pos) const;
+  unsigned int get_neighbour(unsigned int cluster, int dx, int dy) const;
+  MapPos get_origin(unsigned int cluster) const;
+  void set_dirty(unsigned int cluster);
+  void update_clusters();
+
+  bool is_transit(MapPos pos) const;
+  bool can_cross(MapPos pos, Direction dir) const;
+  void add_crossings(unsigned int cluster, MapPos first, Direction along,
+                     Direction dir, Direction alt_dir);
+  void build_crossings(unsigned int cluster);
+  void build_entrances(unsigned int cluster);
+  void search_cluster(MapPos source, bool to_source,
+                      std::vector<unsigned int> *costs) const;
+  unsigned int get_local_index(unsigned int cluster, MapPos pos) const;
+  bool reaches_entrance(unsigned int cluster,
+                        const std::vector<unsigned int> &costs) const;
+
+  bool find_waypoints(MapPos start, MapPos end,
+                      std::vector<MapPos> *waypoints);
+};
+
+#endif  // SRC_PATHFINDER_HIERARCHY_H_
@@ -21,36 +21,15 @@
 
 #include "src/pathfinder.h"
 
-#include <list>
-#include <vector>
 #include <algorithm>
-#include <memory>
-
-class SearchNode;
-
-typedef std::shared_ptr<SearchNode> PSearchNode;
-
-class SearchNode {
- public:
-  PSearchNode parent;
-  unsigned int g_score;
-  unsigned int f_score;
-  MapPos pos;
-  Direction dir;
-};
-
-static bool
-search_node_less(const PSearchNode &left, const PSearchNode &right) {
-  // A search node is considered less than the other if
-  // it has a larger f-score. This means that in the max-heap
-  // the lower score will go to the top.
-  return left->f_score > right->f_score;
-}
+#include <atomic>
+#include <cstdlib>
+#include <thread>
 
 static const unsigned int walk_cost[] = { 255, 319, 383, 447, 511 };
 
-static unsigned int
-heuristic_cost(Map *map, MapPos start, MapPos end) {
+unsigned int
+road_cost_estimate(Map *map, MapPos start, MapPos end) {
   /* Calculate distance to target. */
   int dist_col = map->dist_x(start, end);
   int dist_row = map->dist_y(start, end);
@@ -69,121 +48,498 @@ heuristic_cost(Map *map, MapPos start, MapPos end) {
   return dist > 0 ? dist*walk_cost[h_diff/dist] : 0;
 }
 
-static unsigned int
-actual_cost(Map *map, MapPos pos, Direction dir) {
-  MapPos other_pos = map->move(pos, dir);
-  int h_diff = abs(static_cast<int>(map->get_height(pos)) -
-                   static_cast<int>(map->get_height(other_pos)));
-  return walk_cost[h_diff];
+unsigned int
+road_segment_cost(Map *map, MapPos pos, Direction dir) {
+  return walk_cost[abs(map->get_slope(pos, dir))];
+}
+
+void
+RoadPathfinder::next_stamp(Map *map) {
+  if (nodes.size() != map->geom().tile_count()) {
+    nodes.assign(map->geom().tile_count(), Node());
+    stamp = 0;
+  }
+
+  stamp += 1;
+  if (stamp == 0) {
+    /* Stamps wrapped around, forget all previous searches. */
+    for (Node &node : nodes) {
+      node.stamp = 0;
+      node.blocked_stamp = 0;
+    }
+    stamp = 1;
+  }
+
+  open.clear();
+}
+
+/* Whether the open position left is expanded before right. */
+bool
+RoadPathfinder::is_before(MapPos left, MapPos right) const {
+  return nodes[left].f_score < nodes[right].f_score;
+}
+
+void
+RoadPathfinder::set_open(size_t index, MapPos pos) {
+  open[index] = pos;
+  nodes[pos].heap_index = static_cast<int>(index);
+}
+
+/* Sift pos up from the slot index, but not above the slot top. */
+void
+RoadPathfinder::sift_up(size_t index, size_t top, MapPos pos) {
+  while (index > top) {
+    size_t parent = (index - 1) / 2;
+    if (!is_before(pos, open[parent])) break;
+    set_open(index, open[parent]);
+    index = parent;
+  }
+  set_open(index, pos);
+}
+
+/* Fill the slot index with pos, keeping the subtree below it a heap. The
+   hole first moves down to a leaf along the children expanded first, then
+   pos is sifted up from there. This is how std::pop_heap() and
+   std::make_heap() restore a heap, so positions of equal score are
+   expanded in the same order as with the std::vector based open set this
+   replaces, and the same roads are found. */
+void
+RoadPathfinder::adjust_heap(size_t index, MapPos pos) {
+  size_t size = open.size();
+  size_t hole = index;
+  while (2*hole + 2 < size) {
+    size_t child = 2*hole + 2;
+    if (is_before(open[child - 1], open[child])) child -= 1;
+    set_open(hole, open[child]);
+    hole = child;
+  }
+  if (2*hole + 2 == size) {
+    set_open(hole, open[2*hole + 1]);
+    hole = 2*hole + 1;
+  }
+  sift_up(hole, index, pos);
+}
+
+void
+RoadPathfinder::open_push(MapPos pos) {
+  open.push_back(pos);
+  sift_up(open.size() - 1, 0, pos);
+}
+
+MapPos
+RoadPathfinder::open_pop() {
+  MapPos pos = open.front();
+  MapPos last = open.back();
+  open.pop_back();
+  if (!open.empty()) adjust_heap(0, last);
+  nodes[pos].heap_index = -1;
+  return pos;
+}
+
+/* Lower the score of the open position pos. The position is swapped
+   with the last one and the whole heap is rebuilt, as the old open set
+   did with std::make_heap(). A sift up would be cheaper, but would
+   reorder positions of equal score and change the roads found. */
+void
+RoadPathfinder::open_update(MapPos pos) {
+  size_t index = nodes[pos].heap_index;
+  MapPos last = open.back();
+  set_open(index, last);
+  set_open(open.size() - 1, pos);
+
+  if (open.size() < 2) return;
+  for (size_t parent = (open.size() - 2) / 2 + 1; parent > 0; parent--) {
+    adjust_heap(parent - 1, open[parent - 1]);
+  }
 }
 
 /* Find the shortest path from start to end (using A*) considering that
    the walking time for a serf walking in any direction of the path
-   should be minimized. Returns a malloc'ed array of directions and
-   the size of this array in length. */
+   should be minimized. The search runs from end towards start, so the
+   parent links lead back towards end. Returns an invalid road if start
+   cannot be reached. */
 Road
-pathfinder_map(Map *map, MapPos start, MapPos end, const Road *building_road) {
-  // Unfortunately the STL priority_queue cannot be used since we
-  // would need access to the underlying sequence to determine if
-  // a node is already in the open list. We keep instead open as
-  // a vector and apply std::pop_heap and std::push_heap to keep
-  // it heapified.
-  std::vector<PSearchNode> open;
-  std::list<PSearchNode> closed;
+RoadPathfinder::find_road(Map *map, MapPos start, MapPos end,
+                          const Road *building_road) {
+  next_stamp(map);
 
-  /* Create start node */
-  PSearchNode node(new SearchNode);
-  node->pos = end;
-  node->g_score = 0;
-  node->f_score = heuristic_cost(map, start, end);
+  if (building_road != nullptr) {
+    MapPos pos = building_road->get_source();
+    nodes[pos].blocked_stamp = stamp;
+    for (Direction dir : building_road->get_dirs()) {
+      pos = map->move(pos, dir);
+      nodes[pos].blocked_stamp = stamp;
+    }
+  }
 
-  open.push_back(node);
+  /* Create start node */
+  Node &first = nodes[end];
+  first.stamp = stamp;
+  first.g_score = 0;
+  first.f_score = road_cost_estimate(map, start, end);
+  first.dir = DirectionNone;
+  open_push(end);
 
   while (!open.empty()) {
-    std::pop_heap(open.begin(), open.end(), search_node_less);
-    node = open.back();
-    open.pop_back();
+    MapPos pos = open_pop();
 
-    if (node->pos == start) {
+    if (pos == start) {
       /* Construct solution */
       Road solution;
       solution.start(start);
 
-      while (node->parent) {
-        Direction dir = node->dir;
+      while (nodes[pos].dir != DirectionNone) {
+        Direction dir = nodes[pos].dir;
         solution.extend(reverse_direction(dir));
-        node = node->parent;
+        pos = map->move(pos, reverse_direction(dir));
       }
 
       return solution;
     }
 
-    /* Put current node on closed list. */
-    closed.push_front(node);
-
+    unsigned int g_score = nodes[pos].g_score;
     for (Direction d : cycle_directions_cw()) {
-      MapPos new_pos = map->move(node->pos, d);
-      unsigned int cost = actual_cost(map, node->pos, d);
+      MapPos new_pos = map->move(pos, d);
 
       /* Check if neighbour is valid. */
-      if (!map->is_road_segment_valid(node->pos, d) ||
+      if (!map->is_road_segment_valid(pos, d) ||
           (map->get_obj(new_pos) == Map::ObjectFlag && new_pos != start)) {
         continue;
       }
 
-      if ((building_road != nullptr) && building_road->has_pos(map, new_pos) &&
+      Node &node = nodes[new_pos];
+      if (node.blocked_stamp == stamp &&
           (new_pos != end) && (new_pos != start)) {
         continue;
       }
 
-      /* Check if neighbour is in closed list. */
-      bool in_closed = false;
-      for (PSearchNode closed_node : closed) {
-        if (closed_node->pos == new_pos) {
-          in_closed = true;
-          break;
-        }
+      unsigned int new_g_score = g_score + road_segment_cost(map, pos, d);
+      if (node.stamp != stamp) {
+        /* First time the neighbour is seen in this search. */
+        node.stamp = stamp;
+        node.g_score = new_g_score;
+        node.f_score = new_g_score + road_cost_estimate(map, new_pos, start);
+        node.dir = d;
+        open_push(new_pos);
+      } else if (node.heap_index >= 0 && node.g_score >= new_g_score) {
+        /* Neighbour is open and reached at least as cheaply. */
+        unsigned int h_score = node.f_score - node.g_score;
+        node.g_score = new_g_score;
+        node.f_score = new_g_score + h_score;
+        node.dir = d;
+        open_update(new_pos);
       }
+    }
+  }
+
+  return Road();
+}
+
+void
+RoadTreePathfinder::set_building_road(Map *map, const Road &building_road) {
+  if (started && map == this->map &&
+      building_road.get_source() == this->building_road.get_source() &&
+      building_road.get_dirs() == this->building_road.get_dirs()) {
+    return;
+  }
+
+  this->map = map;
+  this->building_road = building_road;
+  started = false;
+}
+
+/* Positions the tree refused are not stamped, but when one becomes
+   passable it can only be reached from a neighbour the tree reached. */
+void
+RoadTreePathfinder::map_changed(MapPos pos) {
+  if (!started) return;
+
+  if (nodes[pos].stamp == stamp) {
+    started = false;
+    return;
+  }
+  for (Direction d : cycle_directions_cw()) {
+    if (nodes[map->move(pos, d)].stamp == stamp) {
+      started = false;
+      return;
+    }
+  }
+}
+
+void
+RoadTreePathfinder::start() {
+  next_stamp(map);
+
+  MapPos pos = building_road.get_source();
+  nodes[pos].blocked_stamp = stamp;
+  for (Direction dir : building_road.get_dirs()) {
+    pos = map->move(pos, dir);
+    nodes[pos].blocked_stamp = stamp;
+  }
+
+  Node &first = nodes[pos];
+  first.stamp = stamp;
+  first.g_score = 0;
+  first.f_score = 0;
+  first.dir = DirectionNone;
+  open_push(pos);
+
+  started = true;
+}
+
+/* Whether a road can lead on through pos. Roads may end at a flag or on
+   the building road, but not pass them. */
+bool
+RoadTreePathfinder::is_passable(MapPos pos) const {
+  return nodes[pos].dir == DirectionNone ||
+         (map->get_obj(pos) != Map::ObjectFlag &&
+          nodes[pos].blocked_stamp != stamp);
+}
+
+/* Check a road found earlier against the map again, in case the map
+   changed in ways that were not reported. Edges are checked as in
+   RoadPathfinder::find_road(). */
+static bool
+is_found_road_valid(Map *map, const Road &road) {
+  MapPos pos = road.get_source();
+  for (Direction dir : road.get_dirs()) {
+    MapPos next = map->move(pos, dir);
+    if (!map->is_road_segment_valid(next, reverse_direction(dir)) ||
+        (pos != road.get_source() && map->get_obj(pos) == Map::ObjectFlag)) {
+      return false;
+    }
+    pos = next;
+  }
+  return true;
+}
+
+/* Grow the tree like Dijkstra's algorithm, since a heuristic would tie
+   the tree to one destination. Edges are checked as in find_road(), seen
+   from the other end. */
+bool
+RoadTreePathfinder::get_road(MapPos end, Road *road,
+                             unsigned int max_settled) {
+  road->invalidate();
+
+  for (int attempt = 0; attempt < 2; attempt++) {
+    if (!started) start();
+
+    unsigned int settled = 0;
+    while (nodes[end].stamp != stamp || nodes[end].heap_index >= 0) {
+      if (open.empty()) return true;
+      if (max_settled != 0 && settled == max_settled) return false;
 
-      if (in_closed) continue;
-
-      /* See if neighbour is already in open list. */
-      bool in_open = false;
-      for (std::vector<PSearchNode>::iterator it = open.begin();
-           it != open.end(); ++it) {
-        PSearchNode n = *it;
-        if (n->pos == new_pos) {
-          in_open = true;
-          if (n->g_score >= node->g_score + cost) {
-            n->g_score = node->g_score + cost;
-            n->f_score = n->g_score + heuristic_cost(map, new_pos, start);
-            n->parent = node;
-            n->dir = d;
-
-            // Move element to the back and heapify
-            iter_swap(it, open.rbegin());
-            std::make_heap(open.begin(), open.end(), search_node_less);
-          }
-          break;
+      MapPos pos = open_pop();
+      settled += 1;
+      if (!is_passable(pos)) continue;
+
+      unsigned int g_score = nodes[pos].g_score;
+      for (Direction d : cycle_directions_cw()) {
+        MapPos new_pos = map->move(pos, d);
+        if (!map->is_road_segment_valid(new_pos, reverse_direction(d))) {
+          continue;
+        }
+
+        Node &node = nodes[new_pos];
+        unsigned int new_g_score = g_score + road_segment_cost(map, pos, d);
+        if (node.stamp != stamp) {
+          node.stamp = stamp;
+          node.g_score = new_g_score;
+          node.f_score = new_g_score;
+          node.dir = d;
+          open_push(new_pos);
+        } else if (node.heap_index >= 0 && new_g_score < node.g_score) {
+          node.g_score = new_g_score;
+          node.f_score = new_g_score;
+          node.dir = d;
+          sift_up(node.heap_index, 0, new_pos);
         }
       }
+    }
 
-      /* If not found in the open set, create a new node. */
-      if (!in_open) {
-        PSearchNode new_node(new SearchNode);
+    /* Collect the directions from end back to the root. */
+    std::vector<Direction> dirs;
+    MapPos pos = end;
+    while (nodes[pos].dir != DirectionNone) {
+      dirs.push_back(nodes[pos].dir);
+      pos = map->move(pos, reverse_direction(nodes[pos].dir));
+    }
+
+    road->start(pos);
+    for (auto it = dirs.rbegin(); it != dirs.rend(); ++it) {
+      road->extend(*it);
+    }
+
+    if (is_found_road_valid(map, *road)) return true;
+    road->invalidate();
+    started = false;
+  }
+
+  return true;
+}
 
-        new_node->pos = new_pos;
-        new_node->g_score = node->g_score + cost;
-        new_node->f_score = new_node->g_score +
-                            heuristic_cost(map, new_pos, start);
-        new_node->parent = node;
-        new_node->dir = d;
+bool
+RoadCache::Key::operator < (const Key &other) const {
+  if (start != other.start) return start < other.start;
+  if (end != other.end) return end < other.end;
+  return building_road < other.building_road;
+}
 
-        open.push_back(new_node);
-        std::push_heap(open.begin(), open.end(), search_node_less);
+RoadCache::RoadCache(PMap map, size_t max_entries)
+  : map(map)
+  , max_entries(max_entries) {
+  map->add_change_handler(this);
+}
+
+RoadCache::~RoadCache() {
+  map->del_change_handler(this);
+}
+
+void
+RoadCache::clear() {
+  entries_by_pos.clear();
+  entries.clear();
+}
+
+Road
+RoadCache::find_road(MapPos start, MapPos end, const Road *building_road) {
+  Key key;
+  key.start = start;
+  key.end = end;
+  if (building_road != nullptr) {
+    MapPos pos = building_road->get_source();
+    key.building_road.push_back(pos);
+    for (Direction dir : building_road->get_dirs()) {
+      pos = map->move(pos, dir);
+      key.building_road.push_back(pos);
+    }
+    std::sort(key.building_road.begin(), key.building_road.end());
+  }
+
+  Entries::iterator it = entries.find(key);
+  if (it != entries.end()) {
+    if (is_found_road_valid(map.get(), it->second)) return it->second;
+    drop_entry(it);
+  }
+
+  Road road = pathfinder.find_road(map.get(), start, end, building_road);
+  if (!road.is_valid()) return road;
+
+  if (entries.size() >= max_entries) clear();
+  it = entries.insert(std::make_pair(key, road)).first;
+  MapPos pos = start;
+  entries_by_pos.insert(std::make_pair(pos, it));
+  for (Direction dir : road.get_dirs()) {
+    pos = map->move(pos, dir);
+    entries_by_pos.insert(std::make_pair(pos, it));
+  }
+
+  return road;
+}
+
+void
+RoadCache::drop_entry(Entries::iterator entry) {
+  MapPos pos = entry->second.get_source();
+  Road::Dirs dirs = entry->second.get_dirs();
+  Road::Dirs::const_iterator dir = dirs.begin();
+  while (true) {
+    auto range = entries_by_pos.equal_range(pos);
+    for (auto it = range.first; it != range.second; ++it) {
+      if (it->second == entry) {
+        entries_by_pos.erase(it);
+        break;
       }
     }
+    if (dir == dirs.end()) break;
+    pos = map->move(pos, *dir++);
   }
 
-  return Road();
+  entries.erase(entry);
+}
+
+/* Drop the entries with a road through pos. */
+void
+RoadCache::drop_entries_at(MapPos pos) {
+  auto range = entries_by_pos.equal_range(pos);
+  std::vector<Entries::iterator> dropped;
+  for (auto it = range.first; it != range.second; ++it) {
+    dropped.push_back(it->second);
+  }
+
+  for (Entries::iterator entry : dropped) {
+    drop_entry(entry);
+  }
+}
+
+void
+RoadCache::on_height_changed(MapPos pos) {
+  drop_entries_at(pos);
+}
+
+void
+RoadCache::on_object_changed(MapPos pos) {
+  drop_entries_at(pos);
+}
+
+void
+RoadCache::on_owner_changed(MapPos pos) {
+  drop_entries_at(pos);
+}
+
+void
+RoadCache::on_paths_changed(MapPos pos) {
+  drop_entries_at(pos);
+}
+
+RoadBatchPathfinder::RoadBatchPathfinder(const Map &map,
+                                         unsigned int threads) {
+  if (threads == 0) {
+    threads = std::max(1u, std::thread::hardware_concurrency());
+  }
+  pathfinders.resize(threads);
+  update(map);
+}
+
+void
+RoadBatchPathfinder::update(const Map &map) {
+  snapshot.reset(new Map(map));
+}
+
+/* Find the road of every query, or an invalid road where there is none.
+   The workers take the queries in small chunks, as their cost varies a
+   lot. */
+std::vector<Road>
+RoadBatchPathfinder::find_roads(const std::vector<Query> &queries) {
+  static const size_t chunk_size = 16;
+
+  std::vector<Road> roads(queries.size());
+  std::atomic<size_t> next(0);
+  auto work = [&](RoadPathfinder *pathfinder) {
+    for (;;) {
+      size_t first = next.fetch_add(chunk_size);
+      if (first >= queries.size()) break;
+      size_t last = std::min(first + chunk_size, queries.size());
+      for (size_t i = first; i < last; i++) {
+        roads[i] = pathfinder->find_road(snapshot.get(), queries[i].first,
+                                         queries[i].second);
+      }
+    }
+  };
+
+  size_t count = std::min(pathfinders.size(),
+                          (queries.size() + chunk_size - 1) / chunk_size);
+  std::vector<std::thread> threads;
+  for (size_t i = 1; i < count; i++) {
+    threads.push_back(std::thread(work, &pathfinders[i]));
+  }
+  work(&pathfinders[0]);
+  for (std::thread &thread : threads) thread.join();
+
+  return roads;
+}
+
+Road
+pathfinder_map(Map *map, MapPos start, MapPos end, const Road *building_road) {
+  static RoadPathfinder pathfinder;
+  return pathfinder.find_road(map, start, end, building_road);
 }
@@ -22,9 +22,163 @@
 #ifndef SRC_PATHFINDER_H_
 #define SRC_PATHFINDER_H_
 
+#include <map>
+#include <memory>
+#include <utility>
+#include <vector>
+
 #include "src/map.h"
 
+/* Search of the cheapest road between two positions (using A*).
+
+   Scores and parents of the search are kept in arrays indexed by map
+   position and tagged with the stamp of the search they belong to, so
+   nothing is cleared between searches. The open set is a binary heap of
+   positions that knows the heap slot of every open position. */
+class RoadPathfinder {
+ protected:
+  class Node {
+   public:
+    unsigned int stamp;
+    unsigned int g_score;
+    unsigned int f_score;
+    int heap_index;  /* Slot in the open heap, or -1 once closed */
+    Direction dir;  /* Direction taken from the parent */
+    unsigned int blocked_stamp;  /* Position is on the building road */
+  };
+
+  std::vector<Node> nodes;
+  std::vector<MapPos> open;
+  unsigned int stamp;
+
+ public:
+  RoadPathfinder() : stamp(0) {}
+
+  Road find_road(Map *map, MapPos start, MapPos end,
+                 const Road *building_road = nullptr);
+
+ protected:
+  void next_stamp(Map *map);
+  bool is_before(MapPos left, MapPos right) const;
+  void set_open(size_t index, MapPos pos);
+  void sift_up(size_t index, size_t top, MapPos pos);
+  void adjust_heap(size_t index, MapPos pos);
+  void open_push(MapPos pos);
+  MapPos open_pop();
+  void open_update(MapPos pos);
+};
+
+/* Search of the cheapest roads from the end of the road being built to
+   a destination that keeps moving, like the road preview following the
+   cursor.
+
+   The search tree grown from the end of the building road is kept
+   between queries. A destination settled by an earlier query is answered
+   right away, otherwise the search goes on from where it stopped. The
+   tree is only started over when the building road changes or the map
+   changes at a position the tree has reached. */
+class RoadTreePathfinder : public RoadPathfinder {
+ protected:
+  Map *map;
+  Road building_road;
+  bool started;
+
+ public:
+  RoadTreePathfinder() : map(nullptr), started(false) {}
+
+  /* Grow the tree from the end of building_road. */
+  void set_building_road(Map *map, const Road &building_road);
+  /* Forget the tree, e.g. when the road building ends. */
+  void reset() { started = false; }
+  /* Notify that the map at pos changed. */
+  void map_changed(MapPos pos);
+
+  /* Find the road from the end of the building road to end, invalid if
+     end cannot be reached. Returns false if end was not reached after
+     settling max_settled more positions (0 for no limit); the next query
+     then continues the search. */
+  bool get_road(MapPos end, Road *road, unsigned int max_settled = 0);
+
+ protected:
+  void start();
+  bool is_passable(MapPos pos) const;
+};
+
+/* Cache of the roads found by a RoadPathfinder on one map, keyed by
+   start, end and the positions of the building road.
+
+   An entry is dropped when the map reports a change on its road. A road
+   is still checked against the map again before it is returned. Failed
+   searches are not cached, as any change could make them succeed. */
+class RoadCache : public Map::Handler {
+ protected:
+  class Key {
+   public:
+    MapPos start;
+    MapPos end;
+    std::vector<MapPos> building_road;
+
+    bool operator < (const Key &other) const;
+  };
+
+  typedef std::map<Key, Road> Entries;
+  typedef std::multimap<MapPos, Entries::iterator> EntriesByPos;
+
+  PMap map;
+  RoadPathfinder pathfinder;
+  Entries entries;
+  EntriesByPos entries_by_pos;
+  size_t max_entries;
+
+ public:
+  explicit RoadCache(PMap map, size_t max_entries = 4096);
+  virtual ~RoadCache();
+
+  Road find_road(MapPos start, MapPos end,
+                 const Road *building_road = nullptr);
+  size_t get_size() const { return entries.size(); }
+  void clear();
+
+  virtual void on_height_changed(MapPos pos);
+  virtual void on_object_changed(MapPos pos);
+  virtual void on_owner_changed(MapPos pos);
+  virtual void on_paths_changed(MapPos pos);
+
+ protected:
+  void drop_entry(Entries::iterator entry);
+  void drop_entries_at(MapPos pos);
+};
+
+/* Search of many roads at once on worker threads.
+
+   The searches run on a copy of the map taken by the constructor or by
+   update(), so the original map can change while a batch runs. Every
+   worker has its own RoadPathfinder and the results are the same as
+   those of a single RoadPathfinder on the copy. */
+class RoadBatchPathfinder {
+ public:
+  typedef std::pair<MapPos, MapPos> Query;  /* Start and end of a road */
+
+ protected:
+  std::unique_ptr<Map> snapshot;
+  std::vector<RoadPathfinder> pathfinders;
+
+ public:
+  /* Zero threads means one per hardware thread. */
+  explicit RoadBatchPathfinder(const Map &map, unsigned int threads = 0);
+
+  void update(const Map &map);
+  unsigned int get_thread_count() const { return pathfinders.size(); }
+
+  std::vector<Road> find_roads(const std::vector<Query> &queries);
+};
+
 Road pathfinder_map(Map *map, MapPos start, MapPos end,
                     const Road *building_road = nullptr);
 
+/* Walking cost of the road segment from pos in direction dir. */
+unsigned int road_segment_cost(Map *map, MapPos pos, Direction dir);
+/* Estimated walking cost of a road from start to end. */
+unsigned int road_cost_estimate(Map *map, MapPos start, MapPos end);
+
 #endif  // SRC_PATHFINDER_H_
@@ -376,10 +376,8 @@ int
 Player::promote_serfs_to_knights(int number) {
   int promoted = 0;
 
-  for (Serf *serf : game->get_player_serfs(this)) {
-    if (serf->get_state() == Serf::StateIdleInStock &&
-        serf->get_type() == Serf::TypeGeneric) {
-      Inventory *inv = game->get_inventory(serf->get_idle_in_stock_inv_index());
+  for (Inventory *inv : game->get_player_inventories(this)) {
+    for (Serf *serf : game->get_serfs_in_inventory(inv, Serf::TypeGeneric)) {
       if (inv->promote_serf_to_knight(serf)) {
         promoted += 1;
         number -= 1;
@@ -677,7 +675,8 @@ int
 Player::spawn_serf(Serf **serf, Inventory **inventory, bool want_knight) {
   if (!can_spawn()) return -1;
 
-  Game::ListInventories inventories = game->get_player_inventories(this);
+  const Game::PlayerInventories &inventories =
+    game->get_player_inventories(this);
   if (inventories.size() < 1) {
     return -1;
   }
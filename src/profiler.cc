@@ -21,19 +21,170 @@
 
 #include "src/profiler.h"
 
-#include <string>
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <iomanip>
+#include <iostream>
 #include <istream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+# include <windows.h>
+# include <psapi.h>
+#else
+# include <sys/resource.h>
+#endif
 
 #include "src/command_line.h"
 #include "src/log.h"
 #include "src/version.h"
 #include "src/game-manager.h"
+#include "src/savegame.h"
+#include "src/state-hash.h"
+
+typedef std::chrono::steady_clock Clock;
+
+/* Peak resident set size of this process in kilobytes. */
+static uint64_t
+get_peak_rss_kb() {
+#ifdef _WIN32
+  PROCESS_MEMORY_COUNTERS counters;
+  if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters,
+                            sizeof(counters))) {
+    return 0;
+  }
+  return static_cast<uint64_t>(counters.PeakWorkingSetSize) / 1024;
+#else
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) != 0) {
+    return 0;
+  }
+# ifdef __APPLE__
+  /* Darwin reports ru_maxrss in bytes. */
+  return static_cast<uint64_t>(usage.ru_maxrss) / 1024;
+# else
+  return static_cast<uint64_t>(usage.ru_maxrss);
+# endif
+#endif
+}
+
+/* Quote a string for use as a JSON value. */
+static std::string
+json_string(const std::string &str) {
+  std::ostringstream out;
+  out << '"';
+  for (char c : str) {
+    switch (c) {
+      case '"': out << "\\\""; break;
+      case '\\': out << "\\\\"; break;
+      case '\n': out << "\\n"; break;
+      case '\r': out << "\\r"; break;
+      case '\t': out << "\\t"; break;
+      default:
+        if (static_cast<unsigned char>(c) < 0x20) {
+          out << "\\u" << std::hex << std::setw(4) << std::setfill('0')
+              << static_cast<int>(c) << std::dec;
+        } else {
+          out << c;
+        }
+        break;
+    }
+  }
+  out << '"';
+  return out.str();
+}
+
+/* Nearest-rank percentile of sorted samples. */
+static double
+percentile(const std::vector<double> &sorted, double p) {
+  if (sorted.empty()) return 0.;
+  size_t rank = static_cast<size_t>(p / 100. * sorted.size() + 0.5);
+  if (rank < 1) rank = 1;
+  if (rank > sorted.size()) rank = sorted.size();
+  return sorted[rank - 1];
+}
+
+/* Loaded games start paused. */
+static void
+start_game(Game *game, unsigned int game_speed) {
+  game->speed_reset();
+  for (unsigned int s = DEFAULT_GAME_SPEED; s < game_speed; s++) {
+    game->speed_increase();
+  }
+  for (unsigned int s = DEFAULT_GAME_SPEED; s > game_speed; s--) {
+    game->speed_decrease();
+  }
+}
+
+/* Run two copies of the saved game in lockstep and compare their state
+   hashes after every update. Reports the first tick where they differ. */
+static int
+check_determinism(Game *game, const std::string &save_file,
+                  unsigned int tick_count, unsigned int game_speed) {
+  Game other;
+  if (!GameStore::get_instance()->load(save_file, &other)) {
+    return EXIT_FAILURE;
+  }
+  start_game(&other, game_speed);
+
+  StateHashes hashes = game->get_state_hashes();
+  StateHashes other_hashes = other.get_state_hashes();
+  unsigned int updates = 0;
+  while (hashes == other_hashes && updates < tick_count) {
+    game->update();
+    other.update();
+    updates += 1;
+    hashes = game->get_state_hashes();
+    other_hashes = other.get_state_hashes();
+  }
+
+  StateHashes::Part part = hashes.get_first_difference(other_hashes);
+  bool diverged = (part != StateHashes::PartCount);
+
+  std::ostream &out = std::cout;
+  out << "{\n";
+  out << "  \"save\": " << json_string(save_file) << ",\n";
+  out << "  \"version\": " << json_string(FREESERF_VERSION) << ",\n";
+  out << "  \"game_speed\": " << game_speed << ",\n";
+  out << "  \"ticks\": " << updates << ",\n";
+  out << "  \"game_tick\": " << game->get_tick() << ",\n";
+  out << "  \"state_hash\": \"" << std::hex << std::setw(16)
+      << std::setfill('0') << hashes.get_combined() << std::dec << "\",\n";
+  out << "  \"diverged\": " << (diverged ? "true" : "false");
+  if (diverged) {
+    out << ",\n  \"divergent_tick\": " << game->get_tick() << ",\n";
+    out << "  \"divergent_part\": "
+        << json_string(StateHashes::get_part_name(part));
+  }
+  out << "\n}" << std::endl;
+
+  return diverged ? EXIT_FAILURE : EXIT_SUCCESS;
+}
 
 int
 main(int argc, char *argv[]) {
   std::string save_file;
+  unsigned int tick_count = PROFILER_DEFAULT_TICKS;
+  unsigned int warmup_count = PROFILER_DEFAULT_WARMUP;
+  double time_budget = 0.;
+  unsigned int game_speed = DEFAULT_GAME_SPEED;
+  bool check = false;
 
   CommandLine command_line;
+  command_line.add_option('c', "Check determinism instead of measuring",
+                          [&check](){ check = true; });
+  command_line.add_option('d', "Set Debug output level")
+                .add_parameter("NUM", [](std::istream& s) {
+                  int d;
+                  s >> d;
+                  if (d >= 0 && d < Log::LevelMax) {
+                    Log::set_level(static_cast<Log::Level>(d));
+                  }
+                  return true;
+                });
   command_line.add_option('h', "Show this help text", [&command_line](){
                   command_line.show_help();
                   exit(EXIT_SUCCESS);
@@ -43,11 +194,37 @@ main(int argc, char *argv[]) {
                   std::getline(s, save_file);
                   return true;
                 });
+  command_line.add_option('n', "Number of measured ticks (0 for no limit)")
+                .add_parameter("NUM", [&tick_count](std::istream& s) {
+                  s >> tick_count;
+                  return !s.fail();
+                });
+  command_line.add_option('s', "Game speed (ticks advanced per update)")
+                .add_parameter("NUM", [&game_speed](std::istream& s) {
+                  s >> game_speed;
+                  return !s.fail();
+                });
+  command_line.add_option('t', "Wall-clock budget for measured ticks")
+                .add_parameter("SECONDS", [&time_budget](std::istream& s) {
+                  s >> time_budget;
+                  return !s.fail();
+                });
+  command_line.add_option('w', "Number of warmup ticks")
+                .add_parameter("NUM", [&warmup_count](std::istream& s) {
+                  s >> warmup_count;
+                  return !s.fail();
+                });
   command_line.set_comment("Please report bugs to <" PACKAGE_BUGREPORT ">");
   if (!command_line.process(argc, argv) || save_file.empty()) {
     return EXIT_FAILURE;
   }
+  if (tick_count == 0 && time_budget <= 0.) {
+    Log::Error["profiler"] << "either tick count or time budget must be set";
+    return EXIT_FAILURE;
+  }
 
+  /* Keep stdout clean for the report. */
+  Log::set_file(&std::cerr);
   Log::Info["profiler"] << "starts " << FREESERF_VERSION;
 
   GameManager *game_manager = GameManager::get_instance();
@@ -58,9 +235,85 @@ main(int argc, char *argv[]) {
   Log::Info["profiler"] << "loaded game '" << save_file << "'";
 
   PGame game = game_manager->get_current_game();
-  while (true) {
+  start_game(game.get(), game_speed);
+
+  if (check) {
+    if (tick_count == 0) tick_count = PROFILER_DEFAULT_TICKS;
+    int result = check_determinism(game.get(), save_file, tick_count,
+                                   game_speed);
+    delete game_manager;
+    return result;
+  }
+
+  for (unsigned int i = 0; i < warmup_count; i++) {
     game->update();
   }
+#ifdef ENABLE_PROFILING
+  game->reset_tick_profile();
+#endif
+
+  std::vector<double> samples;
+  if (tick_count != 0) samples.reserve(tick_count);
+
+  Clock::time_point start = Clock::now();
+  Clock::time_point deadline = start +
+    std::chrono::duration_cast<Clock::duration>(
+      std::chrono::duration<double>(time_budget));
+  Clock::time_point last = start;
+  while (tick_count == 0 || samples.size() < tick_count) {
+    game->update();
+    Clock::time_point now = Clock::now();
+    samples.push_back(
+      std::chrono::duration<double, std::micro>(now - last).count());
+    last = now;
+    if (time_budget > 0. && now >= deadline) break;
+  }
+  double elapsed = std::chrono::duration<double>(last - start).count();
+
+  double total = 0.;
+  for (double sample : samples) total += sample;
+  double mean = samples.empty() ? 0. : total / samples.size();
+  std::vector<double> sorted(samples);
+  std::sort(sorted.begin(), sorted.end());
+
+  std::ostream &out = std::cout;
+  out << std::fixed << std::setprecision(3);
+  out << "{\n";
+  out << "  \"save\": " << json_string(save_file) << ",\n";
+  out << "  \"version\": " << json_string(FREESERF_VERSION) << ",\n";
+  out << "  \"game_speed\": " << game_speed << ",\n";
+  out << "  \"warmup_ticks\": " << warmup_count << ",\n";
+  out << "  \"ticks\": " << samples.size() << ",\n";
+  out << "  \"game_tick\": " << game->get_tick() << ",\n";
+  out << "  \"elapsed_sec\": " << elapsed << ",\n";
+  out << "  \"ticks_per_sec\": "
+      << (elapsed > 0. ? samples.size() / elapsed : 0.) << ",\n";
+  out << "  \"tick_latency_us\": {\n";
+  out << "    \"mean\": " << mean << ",\n";
+  out << "    \"p50\": " << percentile(sorted, 50.) << ",\n";
+  out << "    \"p99\": " << percentile(sorted, 99.) << ",\n";
+  out << "    \"max\": " << (sorted.empty() ? 0. : sorted.back()) << "\n";
+  out << "  },\n";
+#ifdef ENABLE_PROFILING
+  {
+    const TickProfile &profile = game->get_tick_profile();
+    out << "  \"phases_us\": {\n";
+    for (int i = 0; i < TickProfile::PhaseCount; i++) {
+      TickProfile::Phase phase = static_cast<TickProfile::Phase>(i);
+      const TickProfile::PhaseTimes &times = profile.get_phase(phase);
+      out << "    " << json_string(TickProfile::get_phase_name(phase))
+          << ": {\"calls\": " << times.get_calls()
+          << ", \"mean\": " << times.get_mean_ns() / 1000.
+          << ", \"max\": " << times.get_max_ns() / 1000.
+          << ", \"p99_recent\": "
+          << times.get_window_percentile_ns(99.) / 1000. << "}"
+          << ((i + 1 < TickProfile::PhaseCount) ? ",\n" : "\n");
+    }
+    out << "  },\n";
+  }
+#endif
+  out << "  \"peak_rss_kb\": " << get_peak_rss_kb() << "\n";
+  out << "}" << std::endl;
 
   delete game_manager;
 
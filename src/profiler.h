@@ -26,5 +26,10 @@
 #define TICK_LENGTH  20
 #define TICKS_PER_SEC  (1000/TICK_LENGTH)
 
+/* Default number of measured ticks in a benchmark run. */
+#define PROFILER_DEFAULT_TICKS  10000
+/* Default number of ticks simulated before measuring starts. */
+#define PROFILER_DEFAULT_WARMUP  500
+
 
 #endif  // SRC_PROFILER_H_
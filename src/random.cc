@@ -24,6 +24,8 @@
 #include <ctime>
 #include <sstream>
 
+#include "src/state-hash.h"
+
 Random::Random() {
   srand((unsigned int)time(NULL));
   state[0] = std::rand();
@@ -79,6 +81,13 @@ Random::random() {
   return r;
 }
 
+void
+Random::hash_state(StateHash *hash) const {
+  hash->add(static_cast<uint64_t>(state[0]) |
+            (static_cast<uint64_t>(state[1]) << 16) |
+            (static_cast<uint64_t>(state[2]) << 32));
+}
+
 Random::operator std::string() const {
   uint64_t tmp0 = state[0];
   uint64_t tmp1 = state[1];
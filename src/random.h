@@ -24,6 +24,8 @@
 
 #include <string>
 
+class StateHash;
+
 class Random {
  protected:
   uint16_t state[3];
@@ -44,6 +46,8 @@ class Random {
 
   uint16_t random();
 
+  void hash_state(StateHash *hash) const;
+
   operator std::string() const;
   friend Random& operator^=(Random& left, const Random& right);
 };
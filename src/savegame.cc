@@ -21,6 +21,7 @@
 
 #include "src/savegame.h"
 
+#include <algorithm>
 #include <sstream>
 #include <vector>
 #include <map>
@@ -158,7 +159,10 @@ class SaveReaderTextSection : public SaveReaderText {
 
   virtual const SaveReaderTextValue &
   value(const std::string &val_name) const {
-    Values::const_iterator it = values.find(val_name);
+    /* ConfigFile stores names in lower case. */
+    std::string name = val_name;
+    std::transform(name.begin(), name.end(), name.begin(), ::tolower);
+    Values::const_iterator it = values.find(name);
     if (it == values.end()) {
       std::ostringstream str;
       str << "Failed to load value: " << val_name;
@@ -215,7 +219,10 @@ class SaveReaderTextFile : public SaveReaderText {
 
   virtual const SaveReaderTextValue &
   value(const std::string &name) const {
-    Values::const_iterator it = values.find(name);
+    std::string lower_name = name;
+    std::transform(lower_name.begin(), lower_name.end(), lower_name.begin(),
+                   ::tolower);
+    Values::const_iterator it = values.find(lower_name);
     if (it == values.end()) {
       std::ostringstream str;
       str << "Failed to load value: " << name;
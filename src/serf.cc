@@ -30,6 +30,7 @@
 #include "src/misc.h"
 #include "src/inventory.h"
 #include "src/savegame.h"
+#include "src/state-hash.h"
 
 #define set_state(new_state)  \
   Log::Verbose["serf"] << "serf " << index  \
@@ -37,7 +38,8 @@
                        << "state " << Serf::get_state_name(state) \
                        << " -> " << Serf::get_state_name((new_state)) \
                        << " (" << __FUNCTION__ << ":" << __LINE__ << ")"; \
-  state = new_state;
+  state = new_state; \
+  game->serf_state_changed(this);
 
 #define set_other_state(other_serf, new_state)  \
   Log::Verbose["serf"] << "serf " << other_serf->index \
@@ -46,7 +48,8 @@
                        << Serf::get_state_name(other_serf->state) \
                        << " -> " << Serf::get_state_name((new_state)) \
                        << "(" << __FUNCTION__ << ":" << __LINE__ << ")"; \
-  other_serf->state = new_state;
+  other_serf->state = new_state; \
+  game->serf_state_changed(other_serf);
 
 
 static const int counter_from_animation[] = {
@@ -331,6 +334,8 @@ Serf::set_type(Serf::Type new_type) {
   if (new_type == TypeTransporter) {
     counter = 0;
   }
+
+  game->serf_type_changed(this);
 }
 
 void
@@ -347,10 +352,11 @@ Serf::init_generic(Inventory *inventory) {
   set_type(TypeGeneric);
   set_player(inventory->get_owner());
   Building *building = game->get_building(inventory->get_building_index());
-  pos = building->get_position();
+  set_pos(building->get_position());
   tick = game->get_tick();
-  state = StateIdleInStock;
   s.idle_in_stock.inv_index = inventory->get_index();
+  state = StateIdleInStock;
+  game->serf_state_changed(this);
 }
 
 void
@@ -431,6 +437,19 @@ Serf::path_splited(unsigned int flag_1, Direction dir_1,
   return false;
 }
 
+bool
+Serf::is_road_bound() const {
+  switch (state) {
+    case StateWalking:
+    case StateReadyToLeaveInventory:
+    case StateLeavingBuilding:
+    case StateReadyToLeave:
+      return true;
+    default:
+      return false;
+  }
+}
+
 bool
 Serf::is_related_to(unsigned int dest, Direction dir) {
   bool result = false;
@@ -564,6 +583,7 @@ Serf::building_deleted(MapPos building_pos, bool escape) {
     if (escape) {
       /* Serf is escaping. */
       state = StateEscapeBuilding;
+      game->serf_state_changed(this);
     } else {
       /* Kill this serf. */
       set_type(TypeDead);
@@ -763,8 +783,8 @@ Serf::send_off_to_fight(int dist_col, int dist_row) {
 
 void
 Serf::stay_idle_in_stock(unsigned int inventory) {
-  set_state(StateIdleInStock);
   s.idle_in_stock.inv_index = inventory;
+  set_state(StateIdleInStock);
 }
 
 void
@@ -776,6 +796,22 @@ Serf::go_out_from_building(MapPos dest, int dir, int field_B) {
   s.leaving_building.next_state = StateWalking;
 }
 
+void
+Serf::set_player(unsigned int player_num) {
+  unsigned int old_owner = owner;
+  owner = player_num;
+  if (owner != old_owner) game->serf_owner_changed(this, old_owner);
+}
+
+void
+Serf::set_pos(MapPos new_pos) {
+  if (new_pos == pos) return;
+
+  MapPos old_pos = pos;
+  pos = new_pos;
+  game->serf_pos_changed(this, old_pos);
+}
+
 /* Change serf state to lost, but make necessary clean up
    from any earlier state first. */
 void
@@ -962,9 +998,7 @@ Serf::change_direction(Direction dir, int alt_end) {
   if (!map->has_serf(new_pos)) {
     /* Change direction, not occupied. */
     map->set_serf_index(pos, 0);
-    animation = get_walking_animation(map->get_height(new_pos) -
-                                      map->get_height(pos), (Direction)dir,
-                                      0);
+    animation = get_walking_animation(map->get_slope(pos, dir), dir, 0);
     s.walking.dir = reverse_direction(dir);
   } else {
     /* Direction is occupied. */
@@ -975,17 +1009,15 @@ Serf::change_direction(Direction dir, int alt_end) {
         (other_dir == reverse_direction(dir) || other_dir == DirectionNone) &&
         other_serf->switch_waiting(reverse_direction(dir))) {
       /* Do the switch */
-      other_serf->pos = pos;
+      other_serf->set_pos(pos);
       map->set_serf_index(other_serf->pos, other_serf->get_index());
       other_serf->animation =
-           get_walking_animation(map->get_height(other_serf->pos) -
-                                 map->get_height(new_pos),
+           get_walking_animation(map->get_slope(new_pos,
+                                                reverse_direction(dir)),
                                  reverse_direction(dir), 1);
       other_serf->counter = counter_from_animation[other_serf->animation];
 
-      animation = get_walking_animation(map->get_height(new_pos) -
-                                        map->get_height(pos),
-                                        (Direction)dir, 1);
+      animation = get_walking_animation(map->get_slope(pos, dir), dir, 1);
       s.walking.dir = reverse_direction(dir);
     } else {
       /* Wait for other serf */
@@ -997,7 +1029,7 @@ Serf::change_direction(Direction dir, int alt_end) {
   }
 
   if (!alt_end) s.walking.wait_counter = 0;
-  pos = new_pos;
+  set_pos(new_pos);
   map->set_serf_index(pos, get_index());
   counter += counter_from_animation[animation];
   if (alt_end && counter < 0) {
@@ -1026,9 +1058,11 @@ Serf::transporter_move_to_flag(Flag *flag) {
       Resource::Type temp_res = s.walking.res;
       int temp_dest = s.walking.dest;
 
-      flag->pick_up_resource(res_index, &s.walking.res, &s.walking.dest);
-
-      flag->drop_resource(temp_res, temp_dest);
+      /* Only drop the carried resource if something was picked up,
+         otherwise the resource would be duplicated. */
+      if (flag->pick_up_resource(res_index, &s.walking.res, &s.walking.dest)) {
+        flag->drop_resource(temp_res, temp_dest);
+      }
     }
 
     /* Find next resource to be picked up */
@@ -1044,25 +1078,11 @@ Serf::transporter_move_to_flag(Flag *flag) {
   change_direction(dir, 1);
 }
 
-bool
-Serf::handle_serf_walking_state_search_cb(Flag *flag, void *data) {
-  Serf *serf = static_cast<Serf*>(data);
-  Flag *dest = flag->get_game()->get_flag(serf->s.walking.dest);
-  if (flag == dest) {
-    Log::Verbose["serf"] << " dest found: " << dest->get_search_dir();
-    serf->change_direction(dest->get_search_dir(), 0);
-    return true;
-  }
-
-  return false;
-}
-
 void
 Serf::start_walking(Direction dir, int slope, int change_pos) {
   PMap map = game->get_map();
   MapPos new_pos = map->move(pos, dir);
-  animation = get_walking_animation(map->get_height(new_pos) -
-                                    map->get_height(pos), dir, 0);
+  animation = get_walking_animation(map->get_slope(pos, dir), dir, 0);
   counter += (slope * counter_from_animation[animation]) >> 5;
 
   if (change_pos) {
@@ -1070,7 +1090,7 @@ Serf::start_walking(Direction dir, int slope, int change_pos) {
     map->set_serf_index(new_pos, get_index());
   }
 
-  pos = new_pos;
+  set_pos(new_pos);
 }
 
 static const int road_building_slope[] = {
@@ -1240,17 +1260,12 @@ Serf::handle_serf_walking_state() {
         return;
       } else {
         Flag *src = game->get_flag_at_pos(pos);
-        FlagSearch search(game);
-        for (Direction i : cycle_directions_ccw()) {
-          if (!src->is_water_path(i)) {
-            Flag *other_flag = src->get_other_end_flag(i);
-            other_flag->set_search_dir(i);
-            search.add_source(other_flag);
-          }
+        Direction dir = game->get_walking_dir(src, s.walking.dest);
+        if (dir != DirectionNone) {
+          Log::Verbose["serf"] << " dest found: " << dir;
+          change_direction(dir, 0);
+          continue;
         }
-        bool r = search.execute(handle_serf_walking_state_search_cb,
-                                true, false, this);
-        if (r) continue;
       }
     } else {
       /* 30A37 */
@@ -1331,8 +1346,7 @@ Serf::handle_serf_transporting_state() {
         set_state(StateDelivering);
         s.walking.wait_counter = 0;
 
-        MapPos new_pos = map->move_up_left(pos);
-        animation = 3 + map->get_height(new_pos) - map->get_height(pos) +
+        animation = 3 + map->get_slope(pos, DirectionUpLeft) +
                     (DirectionUpLeft + 6) * 9;
         counter = counter_from_animation[animation];
         /* TODO next call is actually into the middle of
@@ -1409,10 +1423,10 @@ void
 Serf::enter_inventory() {
   game->get_map()->set_serf_index(pos, 0);
   Building *building = game->get_building_at_pos(pos);
-  set_state(StateIdleInStock);
   /*serf->s.idle_in_stock.field_B = 0;
     serf->s.idle_in_stock.field_C = 0;*/
   s.idle_in_stock.inv_index = building->get_inventory()->get_index();
+  set_state(StateIdleInStock);
 }
 
 void
@@ -1754,8 +1768,8 @@ Serf::handle_serf_entering_building_state() {
         }
         inventory->serf_come_back();
 
-        set_state(StateIdleInStock);
         s.idle_in_stock.inv_index = inventory->get_index();
+        set_state(StateIdleInStock);
         break;
       }
       case TypeKnight0:
@@ -1922,21 +1936,20 @@ Serf::handle_serf_digging_state() {
             other_dir == reverse_direction(dir) &&
             other_serf->switch_waiting(other_dir)) {
           /* Do the switch */
-          other_serf->pos = pos;
+          other_serf->set_pos(pos);
           map->set_serf_index(other_serf->pos,
                                           other_serf->get_index());
           other_serf->animation =
-            get_walking_animation(map->get_height(other_serf->pos) -
-                                  map->get_height(new_pos),
+            get_walking_animation(map->get_slope(new_pos,
+                                                 reverse_direction(dir)),
                                   reverse_direction(dir), 1);
           other_serf->counter = counter_from_animation[other_serf->animation];
 
           if (d != 0) {
-            animation =
-                    get_walking_animation(map->get_height(new_pos) -
-                                          map->get_height(pos), dir, 1);
+            animation = get_walking_animation(map->get_slope(pos, dir),
+                                              dir, 1);
           } else {
-            animation = map->get_height(new_pos) - map->get_height(pos);
+            animation = map->get_slope(pos, dir);
           }
         } else {
           counter = 127;
@@ -1946,16 +1959,15 @@ Serf::handle_serf_digging_state() {
       } else {
         map->set_serf_index(pos, 0);
         if (d != 0) {
-          animation =
-                    get_walking_animation(map->get_height(new_pos) -
-                                          map->get_height(pos), dir, 0);
+          animation = get_walking_animation(map->get_slope(pos, dir),
+                                            dir, 0);
         } else {
-          animation = map->get_height(new_pos) - map->get_height(pos);
+          animation = map->get_slope(pos, dir);
         }
       }
 
       map->set_serf_index(new_pos, get_index());
-      pos = new_pos;
+      set_pos(new_pos);
       s.digging.substate = 3;
       counter += counter_from_animation[animation];
     } else if (s.digging.substate == 1) {
@@ -2631,18 +2643,16 @@ Serf::handle_serf_free_walking_switch_with_other() {
     map->set_serf_index(pos, other_serf->index);
     map->set_serf_index(new_pos, index);
 
-    other_serf->animation = get_walking_animation(map->get_height(pos) -
-                                               map->get_height(other_serf->pos),
-                                          reverse_direction((Direction)dir), 1);
-    animation = get_walking_animation(map->get_height(new_pos) -
-                                      map->get_height(pos),
-                                      (Direction)dir, 1);
+    other_serf->animation =
+      get_walking_animation(map->get_slope(new_pos, reverse_direction(dir)),
+                            reverse_direction(dir), 1);
+    animation = get_walking_animation(map->get_slope(pos, dir), dir, 1);
 
     other_serf->counter = counter_from_animation[other_serf->animation];
     counter = counter_from_animation[animation];
 
-    other_serf->pos = pos;
-    pos = new_pos;
+    other_serf->set_pos(pos);
+    set_pos(new_pos);
   } else {
     animation = 82;
     counter = counter_from_animation[animation];
@@ -2939,20 +2949,18 @@ Serf::handle_free_walking_common() {
           (other_dir == reverse_direction(d) || other_dir == DirectionNone) &&
           other_serf->switch_waiting(reverse_direction(d))) {
         /* Do the switch */
-        other_serf->pos = pos;
+        other_serf->set_pos(pos);
         map->set_serf_index(other_serf->pos,
                                         other_serf->get_index());
         other_serf->animation =
-          get_walking_animation(map->get_height(other_serf->pos) -
-            map->get_height(new_pos),
+          get_walking_animation(map->get_slope(new_pos, reverse_direction(d)),
                                 reverse_direction(d), 1);
         other_serf->counter = counter_from_animation[other_serf->animation];
 
-        animation = get_walking_animation(map->get_height(new_pos) -
-                                          map->get_height(pos), d, 1);
+        animation = get_walking_animation(map->get_slope(pos, d), d, 1);
         counter = counter_from_animation[animation];
 
-        pos = new_pos;
+        set_pos(new_pos);
         map->set_serf_index(pos, index);
         return;
       }
@@ -4593,7 +4601,7 @@ Serf::handle_state_knight_free_walking() {
         Serf *other = game->get_serf_at_pos(pos_);
         if (get_player() != other->get_player()) {
           if (other->state == StateKnightFreeWalking) {
-            pos = map->move_left(pos_);
+            set_pos(map->move_left(pos_));
             if (can_pass_map_pos(pos_)) {
               int dist_col = s.free_walking.dist1;
               int dist_row = s.free_walking.dist2;
@@ -5285,6 +5293,130 @@ Serf::update() {
   }
 }
 
+void
+Serf::hash_state(StateHash *hash) const {
+  hash->add(index);
+  hash->add(owner);
+  hash->add(static_cast<uint32_t>(type));
+  hash->add(static_cast<uint32_t>(animation));
+  hash->add(static_cast<uint32_t>(counter));
+  hash->add(pos);
+  hash->add((tick << 8) | state);
+
+  switch (state) {
+    case StateIdleInStock:
+      hash->add_words(s.idle_in_stock);
+      break;
+    case StateWalking:
+      hash->add_words(s.walking);
+      break;
+    case StateTransporting:
+    case StateDelivering:
+      /* dir1 is only used by walking serfs. */
+      hash->add(s.walking.res);
+      hash->add(s.walking.dest);
+      hash->add(static_cast<uint32_t>(s.walking.dir));
+      hash->add(static_cast<uint32_t>(s.walking.wait_counter));
+      break;
+    case StateEnteringBuilding:
+      hash->add_words(s.entering_building);
+      break;
+    case StateLeavingBuilding:
+    case StateReadyToLeave:
+    case StateKnightLeaveForFight:
+      hash->add_words(s.leaving_building);
+      break;
+    case StateReadyToEnter:
+      hash->add_words(s.ready_to_enter);
+      break;
+    case StateDigging:
+      hash->add_words(s.digging);
+      break;
+    case StateBuilding:
+      hash->add_words(s.building);
+      break;
+    case StateBuildingCastle:
+      hash->add_words(s.building_castle);
+      break;
+    case StateMoveResourceOut:
+    case StateDropResourceOut:
+      hash->add_words(s.move_resource_out);
+      break;
+    case StateReadyToLeaveInventory:
+      hash->add_words(s.ready_to_leave_inventory);
+      break;
+    case StateFreeWalking:
+    case StateLogging:
+    case StatePlanting:
+    case StateStoneCutting:
+    case StateStoneCutterFreeWalking:
+    case StateFishing:
+    case StateFarming:
+    case StateSamplingGeoSpot:
+    case StateKnightFreeWalking:
+    case StateKnightAttackingFree:
+    case StateKnightAttackingFreeWait:
+      hash->add_words(s.free_walking);
+      break;
+    case StateSawing:
+    case StateMilling:
+    case StateBaking:
+    case StatePigFarming:
+    case StateButchering:
+    case StateMakingWeapon:
+    case StateMakingTool:
+    case StateBuildingBoat:
+      /* The state data of these workers is just the mode. */
+      hash->add_words(s.sawing);
+      break;
+    case StateLost:
+      hash->add_words(s.lost);
+      break;
+    case StateMining:
+      hash->add_words(s.mining);
+      break;
+    case StateSmelting:
+      hash->add_words(s.smelting);
+      break;
+    case StateKnightEngagingBuilding:
+    case StateKnightPrepareAttacking:
+    case StateKnightPrepareDefendingFreeWait:
+    case StateKnightAttackingDefeatFree:
+    case StateKnightAttacking:
+    case StateKnightAttackingVictory:
+    case StateKnightEngageAttackingFree:
+    case StateKnightEngageAttackingFreeJoin:
+    case StateKnightAttackingVictoryFree:
+      hash->add_words(s.attacking);
+      break;
+    case StateKnightDefendingFree:
+    case StateKnightEngageDefendingFree:
+      hash->add_words(s.defending_free);
+      break;
+    case StateKnightLeaveForWalkToFight:
+      hash->add_words(s.leave_for_walk_to_fight);
+      break;
+    case StateIdleOnPath:
+    case StateWaitIdleOnPath:
+    case StateWakeAtFlag:
+    case StateWakeOnPath:
+      /* Hash the flag index, pointers differ between runs. */
+      hash->add(s.idle_on_path.flag != nullptr ?
+                s.idle_on_path.flag->get_index() : 0);
+      hash->add(static_cast<uint32_t>(s.idle_on_path.field_E));
+      hash->add(s.idle_on_path.rev_dir);
+      break;
+    case StateDefendingHut:
+    case StateDefendingTower:
+    case StateDefendingFortress:
+    case StateDefendingCastle:
+      hash->add_words(s.defending);
+      break;
+    default:
+      break;
+  }
+}
+
 SaveReaderBinary&
 operator >> (SaveReaderBinary &reader, Serf &serf) {
   uint8_t v8;
@@ -5568,6 +5700,13 @@ operator >> (SaveReaderText &reader, Serf &serf) {
       reader.value("state.dest") >> serf.s.walking.dest;
       reader.value("state.dir") >> serf.s.walking.dir;
       reader.value("state.wait_counter") >> serf.s.walking.wait_counter;
+      if (serf.state == Serf::StateWalking) {
+        /* Missing in saves of older versions */
+        try {
+          reader.value("state.dir1") >> serf.s.walking.dir1;
+        } catch (...) {
+        }
+      }
       break;
 
     case Serf::StateEnteringBuilding:
@@ -5772,6 +5911,9 @@ operator << (SaveWriterText &writer, Serf &serf) {
       writer.value("state.dest") << serf.s.walking.dest;
       writer.value("state.dir") << serf.s.walking.dir;
       writer.value("state.wait_counter") << serf.s.walking.wait_counter;
+      if (serf.state == Serf::StateWalking) {
+        writer.value("state.dir1") << serf.s.walking.dir1;
+      }
       break;
 
     case Serf::StateEnteringBuilding:
@@ -33,6 +33,7 @@ class Inventory;
 class SaveReaderBinary;
 class SaveReaderText;
 class SaveWriterText;
+class StateHash;
 
 class Serf : public GameObject {
  public:
@@ -362,7 +363,7 @@ class Serf : public GameObject {
   Serf(Game *game, unsigned int index);
 
   unsigned int get_player() const { return owner; }
-  void set_player(unsigned int player_num) { owner = player_num; }
+  void set_player(unsigned int player_num);
 
   Type get_type() const { return type; }
   void set_type(Type type);
@@ -376,6 +377,7 @@ class Serf : public GameObject {
   int get_counter() const { return counter; }
 
   MapPos get_pos() const { return pos; }
+  void set_pos(MapPos new_pos);
 
   int train_knight(int p);
 
@@ -388,6 +390,9 @@ class Serf : public GameObject {
   bool path_splited(unsigned int flag_1, Direction dir_1,
                     unsigned int flag_2, Direction dir_2,
                     int *select);
+  /* Whether the serf is in a state that heads for a road. Only these serfs
+     can be related to a road (see is_related_to()). */
+  bool is_road_bound() const;
   bool is_related_to(unsigned int dest, Direction dir);
   void path_deleted(unsigned int dest, Direction dir);
   void path_merged(Flag *flag);
@@ -436,6 +441,10 @@ class Serf : public GameObject {
   static const char *get_state_name(State state);
   static const char *get_type_name(Type type);
 
+  /* Add the serf state to hash. Only the state data that is in use by
+     the current state is included, as in the saved game. */
+  void hash_state(StateHash *hash) const;
+
   friend SaveReaderBinary&
     operator >> (SaveReaderBinary &reader, Serf &serf);
   friend SaveReaderText&
@@ -458,8 +467,6 @@ class Serf : public GameObject {
   bool can_pass_map_pos(MapPos pos);
   void set_fight_outcome(Serf *attacker, Serf *defender);
 
-  static bool handle_serf_walking_state_search_cb(Flag *flag, void *data);
-
   void handle_serf_idle_in_stock_state();
   void handle_serf_walking_state_dest_reached();
   void handle_serf_walking_state_waiting();
@@ -0,0 +1,32 @@
+/*
+ * state-hash.cc - Hashing of the game state for determinism checks
+ *
+ * Copyright (C) 2018  Wicked_Digger <wicked_digger@mail.ru>
+ *
+ * This file is part of freeserf.
+ *
+ * freeserf is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * freeserf is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with freeserf.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "src/state-hash.h"
+
+const char *
+StateHashes::get_part_name(Part part) {
+  const char *part_name[] = {
+    "map", "serfs", "flags", "buildings", "inventories", "game"
+  };
+
+  if (part >= PartCount) return "none";
+  return part_name[part];
+}
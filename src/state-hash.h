@@ -0,0 +1,110 @@
+/*
+ * state-hash.h - Hashing of the game state for determinism checks
+ *
+ * Copyright (C) 2018  Wicked_Digger <wicked_digger@mail.ru>
+ *
+ * This file is part of freeserf.
+ *
+ * freeserf is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * freeserf is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with freeserf.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SRC_STATE_HASH_H_
+#define SRC_STATE_HASH_H_
+
+#include <cstdint>
+#include <cstddef>
+
+/* Accumulates 64-bit words into a hash (FNV-1a over words).
+
+   The hash only depends on the values added and their order, never on
+   pointers, so two runs of the same game produce the same hash. */
+class StateHash {
+ protected:
+  uint64_t value;
+
+ public:
+  StateHash() : value(14695981039346656037ULL) {}
+
+  void add(uint64_t word) {
+    value ^= word;
+    value *= 1099511628211ULL;
+  }
+  void add(const int *words, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+      add(static_cast<uint32_t>(words[i]));
+    }
+  }
+
+  /* Add a struct made of int sized fields only. */
+  template<typename T> void add_words(const T &data) {
+    static_assert(sizeof(T) % sizeof(int) == 0, "not made of int words");
+    add(reinterpret_cast<const int*>(&data), sizeof(T) / sizeof(int));
+  }
+
+  uint64_t get_value() const { return mix(value); }
+
+  /* Avalanche the bits of value (finalizer of SplitMix64). */
+  static uint64_t mix(uint64_t value) {
+    value ^= value >> 30;
+    value *= 0xbf58476d1ce4e5b9ULL;
+    value ^= value >> 27;
+    value *= 0x94d049bb133111ebULL;
+    value ^= value >> 31;
+    return value;
+  }
+};
+
+/* Hashes of the parts of a game state at one tick. */
+class StateHashes {
+ public:
+  typedef enum Part {
+    PartMap = 0,
+    PartSerfs,
+    PartFlags,
+    PartBuildings,
+    PartInventories,
+    PartGame,  /* Random generator, tick and counters of the game */
+
+    PartCount
+  } Part;
+
+  uint64_t parts[PartCount];
+
+  StateHashes() : parts() {}
+
+  uint64_t get_combined() const {
+    StateHash hash;
+    for (int i = 0; i < PartCount; i++) hash.add(parts[i]);
+    return hash.get_value();
+  }
+
+  /* First part that differs from other, or PartCount if none. */
+  Part get_first_difference(const StateHashes &other) const {
+    for (int i = 0; i < PartCount; i++) {
+      if (parts[i] != other.parts[i]) return static_cast<Part>(i);
+    }
+    return PartCount;
+  }
+
+  bool operator == (const StateHashes &other) const {
+    return get_first_difference(other) == PartCount;
+  }
+  bool operator != (const StateHashes &other) const {
+    return !(*this == other);
+  }
+
+  static const char *get_part_name(Part part);
+};
+
+#endif  // SRC_STATE_HASH_H_
@@ -0,0 +1,496 @@
+/*
+ * stress-scenario.cc - Generator of dense economies for benchmarks
+ *
+ * Copyright (C) 2018  Wicked_Digger <wicked_digger@mail.ru>
+ *
+ * This file is part of freeserf.
+ *
+ * freeserf is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * freeserf is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with freeserf.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "src/stress-scenario.h"
+
+#include <algorithm>
+#include <cstdlib>
+
+#include "src/mission.h"
+#include "src/log.h"
+
+/* Number of spiral positions covering a radius of four around a pos. */
+#define BORDER_SPIRAL_SIZE  (1+6+12+18+24)
+
+/* Number of spiral positions covering the military influence radius of
+   eight (see Game::update_land_ownership()). */
+#define INFLUENCE_SPIRAL_SIZE  (1+3*8*9)
+
+/* Maximum number of positions tried per player in a building round. */
+#define MAX_ROUND_ATTEMPTS  2048
+
+/* Maximum number of new buildings and flags per player and round. */
+#define MAX_ROUND_PLACEMENTS  48
+
+/* Construction material kept in stock for every inventory. */
+#define RESTOCK_LEVEL  50
+
+/* Resources needed to keep construction going. */
+static const Resource::Type restock_resources[] = {
+  Resource::TypePlank,
+  Resource::TypeStone,
+  Resource::TypeHammer,
+};
+
+static const Player::Color scenario_colors[] = {
+  {0x00, 0xe3, 0xe3},
+  {0xcf, 0x63, 0x63},
+  {0xdf, 0x7f, 0xef},
+  {0xef, 0xef, 0x8f}
+};
+
+/* Military buildings used for expansion, in order of preference. */
+static const Building::Type military_buildings[] = {
+  Building::TypeTower,
+  Building::TypeHut,
+};
+
+/* Buildings used to fill the land, tried in order from a rotating start. */
+static const Building::Type economy_buildings[] = {
+  Building::TypeLumberjack,
+  Building::TypeFarm,
+  Building::TypeStonecutter,
+  Building::TypeSawmill,
+  Building::TypeForester,
+  Building::TypePigFarm,
+  Building::TypeCoalMine,
+  Building::TypeMill,
+  Building::TypeButcher,
+  Building::TypeIronMine,
+  Building::TypeBaker,
+  Building::TypeFisher,
+  Building::TypeSteelSmelter,
+  Building::TypeStoneMine,
+  Building::TypeToolMaker,
+  Building::TypeGoldMine,
+  Building::TypeWeaponSmith,
+  Building::TypeStock,
+  Building::TypeGoldSmelter,
+};
+
+StressScenario::StressScenario(unsigned int map_size,
+                               unsigned int player_count,
+                               const Random &random)
+  : map_size(map_size)
+  , player_count(player_count)
+  , random(random)
+  , target_flags(250)
+  , max_ticks(200000)
+  , round_ticks(250)
+  , game_speed(16)
+  , max_pending_military(8)
+  , max_road_length(6)
+  , stamp(0) {
+  if (this->player_count < 1) this->player_count = 1;
+  if (this->player_count > max_players) this->player_count = max_players;
+}
+
+bool
+StressScenario::generate() {
+  GameInfo info(random);
+  info.set_map_size(map_size);
+  info.remove_all_players();
+  for (unsigned int i = 0; i < player_count; i++) {
+    info.add_player(12 + (i & 1), scenario_colors[i], 40, 40, 50);
+  }
+
+  game = info.instantiate();
+  if (!game) return false;
+  map = game->get_map();
+
+  size_t tile_count = map->get_cols() * map->get_rows();
+  visit_stamp.assign(tile_count, 0);
+  visit_dir.assign(tile_count, DirectionNone);
+  stamp = 0;
+
+  if (!place_castles()) {
+    Log::Warn["stress"] << "failed to place castles";
+    return false;
+  }
+
+  /* Advance the game in larger steps while growing. */
+  game->speed_reset();
+  for (unsigned int i = DEFAULT_GAME_SPEED; i < game_speed; i++) {
+    game->speed_increase();
+  }
+
+  unsigned int ticks = 0;
+  while (ticks < max_ticks) {
+    bool target_reached = true;
+    for (unsigned int i = 0; i < player_count; i++) {
+      Player *player = game->get_player(i);
+      if (get_flag_count(i) >= target_flags) continue;
+      target_reached = false;
+      restock(player);
+      build_round(player);
+    }
+
+    if (target_reached) break;
+
+    for (unsigned int i = 0; i < round_ticks && ticks < max_ticks; i++) {
+      game->update();
+      ticks += 1;
+    }
+
+    Log::Verbose["stress"] << "tick " << ticks << ": "
+                           << get_flag_count(0) << " flags for player 0";
+  }
+
+  game->speed_reset();
+
+  Log::Info["stress"] << "generated scenario in " << ticks << " updates";
+
+  return true;
+}
+
+/* Place each castle as close as possible to the center of a map quadrant. */
+bool
+StressScenario::place_castles() {
+  int cols = map->get_cols();
+  int rows = map->get_rows();
+
+  for (unsigned int i = 0; i < player_count; i++) {
+    Player *player = game->get_player(i);
+    MapPos center = map->pos(cols/4 + (i & 1)*cols/2,
+                             rows/4 + ((i >> 1) & 1)*rows/2);
+
+    bool placed = false;
+    for (int r = 0; r < cols/4 && !placed; r++) {
+      for (int y = -r; y <= r && !placed; y++) {
+        for (int x = -r; x <= r && !placed; x++) {
+          if (std::abs(x) != r && std::abs(y) != r) continue;
+          MapPos pos = map->pos_add(center, x, y);
+          if (game->can_build_castle(pos, player)) {
+            placed = game->build_castle(pos, player);
+          }
+        }
+      }
+    }
+
+    if (!placed) return false;
+  }
+
+  return true;
+}
+
+/* Place new military buildings near the border and fill the owned land with
+   flags, roads and economy buildings. Returns whether anything was built. */
+bool
+StressScenario::build_round(Player *player) {
+  std::vector<bool> connected;
+  find_connected_flags(player, &connected);
+
+  unsigned int owner = player->get_index();
+  size_t tile_count = visit_stamp.size();
+  unsigned int placed = 0;
+
+  /* Expand territory */
+  unsigned int pending = count_pending_military(player);
+  size_t offset = random_offset(tile_count);
+  for (size_t i = 0; i < tile_count && pending < max_pending_military; i++) {
+    MapPos pos = static_cast<MapPos>((offset + i) % tile_count);
+    if (!map->has_owner(pos) || map->get_owner(pos) != owner) continue;
+    if (!is_near_border(pos, owner)) continue;
+    /* Taking land from another player burns its buildings, so the
+       territories only grow into free land. */
+    if (is_near_enemy(pos, owner)) continue;
+    for (Building::Type type : military_buildings) {
+      if (try_building(player, pos, type, &connected)) {
+        pending += 1;
+        placed += 1;
+        break;
+      }
+    }
+  }
+
+  /* Fill owned land, keeping enough free serfs to staff the new roads and
+     buildings. */
+  size_t free_serfs = 0;
+  for (Inventory *inventory : game->get_player_inventories(player)) {
+    free_serfs += inventory->free_serf_count();
+  }
+  size_t budget = placed + std::min<size_t>(free_serfs / 2,
+                                            MAX_ROUND_PLACEMENTS);
+
+  offset = random_offset(tile_count);
+  size_t attempts = 0;
+  for (size_t i = 0; i < tile_count && attempts < MAX_ROUND_ATTEMPTS &&
+                     placed < budget; i++) {
+    MapPos pos = static_cast<MapPos>((offset + i) % tile_count);
+    if (!map->has_owner(pos) || map->get_owner(pos) != owner) continue;
+    attempts += 1;
+
+    if ((random.random() & 1) == 0) {
+      if (try_flag(player, pos, &connected)) placed += 1;
+      continue;
+    }
+
+    size_t type_count = sizeof(economy_buildings) /
+                        sizeof(economy_buildings[0]);
+    size_t first = random.random() % type_count;
+    for (size_t j = 0; j < type_count; j++) {
+      Building::Type type = economy_buildings[(first + j) % type_count];
+      if (try_building(player, pos, type, &connected)) {
+        placed += 1;
+        break;
+      }
+    }
+  }
+
+  return (placed > 0);
+}
+
+/* Refill construction material in all inventories of the player, so the
+   expansion is not limited by how the economy happened to develop. */
+void
+StressScenario::restock(Player *player) {
+  for (Inventory *inventory : game->get_player_inventories(player)) {
+    for (Resource::Type res : restock_resources) {
+      while (inventory->get_count_of(res) < RESTOCK_LEVEL) {
+        inventory->push_resource(res);
+      }
+    }
+  }
+}
+
+size_t
+StressScenario::random_offset(size_t range) {
+  size_t value = static_cast<size_t>(random.random()) << 16;
+  value |= random.random();
+  return value % range;
+}
+
+/* Military buildings that still wait to be built or occupied. */
+unsigned int
+StressScenario::count_pending_military(Player *player) {
+  unsigned int count = 0;
+  for (Building *building : game->get_player_buildings(player)) {
+    if (building->get_type() == Building::TypeCastle) continue;
+    if (building->is_military() &&
+        (!building->is_done() || !building->has_knight())) {
+      count += 1;
+    }
+  }
+  return count;
+}
+
+static bool
+mark_connected_cb(Flag *flag, void *data) {
+  std::vector<bool> *connected = static_cast<std::vector<bool>*>(data);
+  if (connected->size() <= flag->get_index()) {
+    connected->resize(flag->get_index() + 1, false);
+  }
+  (*connected)[flag->get_index()] = true;
+  return false;
+}
+
+/* Mark all flags reachable by land from the inventories of the player. */
+void
+StressScenario::find_connected_flags(Player *player,
+                                     std::vector<bool> *connected) {
+  connected->clear();
+
+  FlagSearch search(game.get());
+  for (Inventory *inventory : game->get_player_inventories(player)) {
+    search.add_source(game->get_flag(inventory->get_flag_index()));
+  }
+  search.execute(mark_connected_cb, true, false, connected);
+}
+
+void
+StressScenario::mark_connected(MapPos pos,
+                               std::vector<bool> *connected) const {
+  unsigned int index = map->get_obj_index(pos);
+  if (connected->size() <= index) connected->resize(index + 1, false);
+  (*connected)[index] = true;
+}
+
+/* Breadth first search for the shortest road from start to any flag connected
+   to the player's network, not passing through avoid. */
+bool
+StressScenario::find_road(MapPos start, MapPos avoid,
+                          const std::vector<bool> &connected, Road *road) {
+  stamp += 1;
+
+  std::vector<MapPos> queue;
+  std::vector<unsigned int> depth;
+  queue.push_back(start);
+  depth.push_back(0);
+  visit_stamp[start] = stamp;
+
+  for (size_t head = 0; head < queue.size(); head++) {
+    MapPos pos = queue[head];
+    unsigned int d = depth[head];
+    if (d >= max_road_length) continue;
+
+    for (Direction dir : cycle_directions_cw()) {
+      MapPos other = map->move(pos, dir);
+      if (other == avoid || visit_stamp[other] == stamp) continue;
+      if (!map->is_road_segment_valid(pos, dir)) continue;
+
+      visit_stamp[other] = stamp;
+      visit_dir[other] = dir;
+
+      if (map->has_flag(other)) {
+        unsigned int index = map->get_obj_index(other);
+        if (index >= connected.size() || !connected[index]) continue;
+
+        /* Trace back to start */
+        std::vector<Direction> dirs;
+        for (MapPos p = other; p != start;
+             p = map->move(p, reverse_direction(visit_dir[p]))) {
+          dirs.push_back(visit_dir[p]);
+        }
+
+        road->invalidate();
+        road->start(start);
+        for (auto it = dirs.rbegin(); it != dirs.rend(); ++it) {
+          road->extend(*it);
+        }
+        return true;
+      }
+
+      queue.push_back(other);
+      depth.push_back(d + 1);
+    }
+  }
+
+  return false;
+}
+
+/* Whether land not owned by owner is within a radius of four. */
+bool
+StressScenario::is_near_border(MapPos pos, unsigned int owner) const {
+  for (int i = 0; i < BORDER_SPIRAL_SIZE; i++) {
+    MapPos p = map->pos_add_spirally(pos, i);
+    if (!map->has_owner(p) || map->get_owner(p) != owner) return true;
+  }
+  return false;
+}
+
+/* Whether land of another player is within military influence of pos. */
+bool
+StressScenario::is_near_enemy(MapPos pos, unsigned int owner) const {
+  for (int i = 0; i < INFLUENCE_SPIRAL_SIZE; i++) {
+    MapPos p = map->pos_add_spirally(pos, i);
+    if (map->has_owner(p) && map->get_owner(p) != owner) return true;
+  }
+  return false;
+}
+
+/* Build a building at pos only if its flag can be connected to the network. */
+bool
+StressScenario::try_building(Player *player, MapPos pos, Building::Type type,
+                             std::vector<bool> *connected) {
+  if (!game->can_build_building(pos, type, player)) return false;
+
+  MapPos flag_pos = map->move_down_right(pos);
+  if (map->has_serf(pos) || map->has_serf(flag_pos)) return false;
+
+  bool has_flag = map->has_flag(flag_pos);
+  if (has_flag) {
+    unsigned int index = map->get_obj_index(flag_pos);
+    if (index >= connected->size() || !(*connected)[index]) return false;
+  } else if (map->paths(flag_pos) == 0) {
+    Road road;
+    if (!find_road(flag_pos, pos, *connected, &road)) return false;
+  } else {
+    /* The flag will split a road; it is connected when the road is. */
+  }
+
+  if (!game->build_building(pos, type, player)) return false;
+
+  if (!has_flag && (map->paths(flag_pos) & ~BIT(DirectionUpLeft)) == 0) {
+    Road road;
+    if (find_road(flag_pos, pos, *connected, &road)) {
+      game->build_road(road, player);
+    }
+  }
+  mark_connected(flag_pos, connected);
+
+  return true;
+}
+
+/* Build a flag at pos, either splitting a road or connected by a new road. */
+bool
+StressScenario::try_flag(Player *player, MapPos pos,
+                         std::vector<bool> *connected) {
+  if (!game->can_build_flag(pos, player)) return false;
+  /* A lumberjack still felling a tree keeps setting the map object of its
+     tile even after the map update turned it into a stub, which would
+     overwrite the new flag. */
+  if (map->has_serf(pos)) return false;
+
+  if (map->paths(pos) != 0) {
+    if (!game->build_flag(pos, player)) return false;
+    mark_connected(pos, connected);
+    return true;
+  }
+
+  Road road;
+  if (!find_road(pos, bad_map_pos, *connected, &road)) return false;
+  if (!game->build_flag(pos, player)) return false;
+
+  /* Search again now that the flag is placed. */
+  if (find_road(pos, bad_map_pos, *connected, &road)) {
+    game->build_road(road, player);
+  }
+  mark_connected(pos, connected);
+
+  return true;
+}
+
+unsigned int
+StressScenario::get_flag_count(unsigned int player) const {
+  unsigned int count = 0;
+  for (MapPos pos : map->geom()) {
+    if (map->has_flag(pos) && map->has_owner(pos) &&
+        map->get_owner(pos) == player) {
+      count += 1;
+    }
+  }
+  return count;
+}
+
+unsigned int
+StressScenario::get_building_count(unsigned int player) const {
+  unsigned int count = 0;
+  for (MapPos pos : map->geom()) {
+    if (map->has_building(pos) && map->has_owner(pos) &&
+        map->get_owner(pos) == player) {
+      count += 1;
+    }
+  }
+  return count;
+}
+
+/* Number of road segments, counting each segment once. */
+unsigned int
+StressScenario::get_road_count(unsigned int player) const {
+  unsigned int count = 0;
+  for (MapPos pos : map->geom()) {
+    if (!map->has_owner(pos) || map->get_owner(pos) != player) continue;
+    for (Direction d : cycle_directions_cw(DirectionRight, 3)) {
+      if (map->has_path(pos, d)) count += 1;
+    }
+  }
+  return count;
+}
@@ -0,0 +1,102 @@
+/*
+ * stress-scenario.h - Generator of dense economies for benchmarks
+ *
+ * Copyright (C) 2018  Wicked_Digger <wicked_digger@mail.ru>
+ *
+ * This file is part of freeserf.
+ *
+ * freeserf is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * freeserf is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with freeserf.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SRC_STRESS_SCENARIO_H_
+#define SRC_STRESS_SCENARIO_H_
+
+#include <vector>
+
+#include "src/game.h"
+#include "src/random.h"
+
+/* Grows a dense economy for every player of a new game.
+
+   The generator builds through the public game interface
+   (build_castle(), build_flag(), build_road() and build_building()) and
+   lets the simulation run between building rounds, so territory expands
+   as military huts get occupied. The only shortcut is that inventories
+   are kept stocked with construction material.
+
+   1. Construct a StressScenario with map size, player count and seed.
+   2. Optionally adjust the targets and the tick budget.
+   3. Call generate() and save the game returned by get_game(). */
+class StressScenario {
+ public:
+  static const unsigned int max_players = GAME_MAX_PLAYER_COUNT;
+
+ protected:
+  unsigned int map_size;
+  unsigned int player_count;
+  Random random;
+
+  unsigned int target_flags;
+  unsigned int max_ticks;
+  unsigned int round_ticks;
+  unsigned int game_speed;
+  unsigned int max_pending_military;
+  unsigned int max_road_length;
+
+  PGame game;
+  PMap map;
+
+  /* Scratch data for road searches */
+  std::vector<unsigned int> visit_stamp;
+  std::vector<Direction> visit_dir;
+  unsigned int stamp;
+
+ public:
+  StressScenario(unsigned int map_size, unsigned int player_count,
+                 const Random &random);
+
+  /* Stop growing once every player owns this many flags. */
+  void set_target_flags(unsigned int count) { target_flags = count; }
+  /* Maximum number of simulated game updates. */
+  void set_max_ticks(unsigned int ticks) { max_ticks = ticks; }
+  /* Number of game updates simulated between building rounds. */
+  void set_round_ticks(unsigned int ticks) { round_ticks = ticks; }
+  /* Game speed used while growing (see Game::speed_increase()). */
+  void set_game_speed(unsigned int speed) { game_speed = speed; }
+
+  bool generate();
+
+  PGame get_game() const { return game; }
+  unsigned int get_flag_count(unsigned int player) const;
+  unsigned int get_building_count(unsigned int player) const;
+  unsigned int get_road_count(unsigned int player) const;
+
+ protected:
+  bool place_castles();
+  void restock(Player *player);
+  bool build_round(Player *player);
+  size_t random_offset(size_t range);
+  unsigned int count_pending_military(Player *player);
+  void find_connected_flags(Player *player, std::vector<bool> *connected);
+  bool find_road(MapPos start, MapPos avoid,
+                 const std::vector<bool> &connected, Road *road);
+  bool is_near_border(MapPos pos, unsigned int owner) const;
+  bool is_near_enemy(MapPos pos, unsigned int owner) const;
+  bool try_building(Player *player, MapPos pos, Building::Type type,
+                    std::vector<bool> *connected);
+  bool try_flag(Player *player, MapPos pos, std::vector<bool> *connected);
+  void mark_connected(MapPos pos, std::vector<bool> *connected) const;
+};
+
+#endif  // SRC_STRESS_SCENARIO_H_
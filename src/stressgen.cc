@@ -0,0 +1,115 @@
+/*
+ * stressgen.cc - Tool generating stress scenarios for benchmarks
+ *
+ * Copyright (C) 2018  Wicked_Digger <wicked_digger@mail.ru>
+ *
+ * This file is part of freeserf.
+ *
+ * freeserf is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * freeserf is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with freeserf.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string>
+#include <istream>
+
+#include "src/command_line.h"
+#include "src/log.h"
+#include "src/version.h"
+#include "src/savegame.h"
+#include "src/stress-scenario.h"
+
+int
+main(int argc, char *argv[]) {
+  std::string save_file;
+  std::string seed = "8667715887436237";
+  unsigned int map_size = 5;
+  unsigned int player_count = 4;
+  unsigned int target_flags = 250;
+  unsigned int max_ticks = 200000;
+
+  CommandLine command_line;
+  command_line.add_option('d', "Set Debug output level")
+                .add_parameter("NUM", [](std::istream& s) {
+                  int d;
+                  s >> d;
+                  if (d >= 0 && d < Log::LevelMax) {
+                    Log::set_level(static_cast<Log::Level>(d));
+                  }
+                  return true;
+                });
+  command_line.add_option('f', "Target number of flags per player")
+                .add_parameter("NUM", [&target_flags](std::istream& s) {
+                  s >> target_flags;
+                  return !s.fail();
+                });
+  command_line.add_option('h', "Show this help text", [&command_line](){
+                  command_line.show_help();
+                  exit(EXIT_SUCCESS);
+                });
+  command_line.add_option('m', "Map size (3-10)")
+                .add_parameter("SIZE", [&map_size](std::istream& s) {
+                  s >> map_size;
+                  return !s.fail() && map_size >= 3 && map_size <= 10;
+                });
+  command_line.add_option('o', "Write scenario to file")
+                .add_parameter("FILE", [&save_file](std::istream& s) {
+                  std::getline(s, save_file);
+                  return true;
+                });
+  command_line.add_option('p', "Number of players (1-4)")
+                .add_parameter("NUM", [&player_count](std::istream& s) {
+                  s >> player_count;
+                  return !s.fail() && player_count >= 1 &&
+                         player_count <= StressScenario::max_players;
+                });
+  command_line.add_option('r', "Random seed of the map (16 digits)")
+                .add_parameter("SEED", [&seed](std::istream& s) {
+                  s >> seed;
+                  return (seed.size() == 16);
+                });
+  command_line.add_option('t', "Maximum number of simulated game updates")
+                .add_parameter("NUM", [&max_ticks](std::istream& s) {
+                  s >> max_ticks;
+                  return !s.fail();
+                });
+  command_line.set_comment("Please report bugs to <" PACKAGE_BUGREPORT ">");
+  if (!command_line.process(argc, argv) || save_file.empty()) {
+    return EXIT_FAILURE;
+  }
+
+  Log::Info["stressgen"] << "starts " << FREESERF_VERSION;
+
+  StressScenario scenario(map_size, player_count, Random(seed));
+  scenario.set_target_flags(target_flags);
+  scenario.set_max_ticks(max_ticks);
+  if (!scenario.generate()) {
+    Log::Error["stressgen"] << "failed to generate scenario";
+    return EXIT_FAILURE;
+  }
+
+  for (unsigned int i = 0; i < player_count; i++) {
+    Log::Info["stressgen"] << "player " << i << ": "
+                           << scenario.get_flag_count(i) << " flags, "
+                           << scenario.get_road_count(i) << " road segments, "
+                           << scenario.get_building_count(i) << " buildings";
+  }
+
+  PGame game = scenario.get_game();
+  if (!GameStore::get_instance()->save(save_file, game.get())) {
+    Log::Error["stressgen"] << "failed to write '" << save_file << "'";
+    return EXIT_FAILURE;
+  }
+  Log::Info["stressgen"] << "saved scenario to '" << save_file << "'";
+
+  return EXIT_SUCCESS;
+}
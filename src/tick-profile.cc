@@ -0,0 +1,134 @@
+/*
+ * tick-profile.cc - Timing of game update phases
+ *
+ * Copyright (C) 2018  Wicked_Digger <wicked_digger@mail.ru>
+ *
+ * This file is part of freeserf.
+ *
+ * freeserf is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * freeserf is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with freeserf.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "src/tick-profile.h"
+
+#include <limits>
+
+void
+TickProfile::PhaseTimes::reset() {
+  calls = 0;
+  total_ns = 0;
+  max_ns = 0;
+  next_sample = 0;
+  sample_count = 0;
+  for (size_t i = 0; i < window_size; i++) samples[i] = 0;
+  for (size_t i = 0; i < bucket_count; i++) buckets[i] = 0;
+}
+
+size_t
+TickProfile::PhaseTimes::bucket_for(uint64_t ns) {
+  size_t bucket = 0;
+  while (ns > 1 && bucket < bucket_count - 1) {
+    ns >>= 1;
+    bucket++;
+  }
+  return bucket;
+}
+
+void
+TickProfile::PhaseTimes::record(uint64_t ns) {
+  calls += 1;
+  total_ns += ns;
+  if (ns > max_ns) max_ns = ns;
+
+  if (ns > std::numeric_limits<uint32_t>::max()) {
+    ns = std::numeric_limits<uint32_t>::max();
+  }
+
+  /* Drop the oldest sample from the histogram once the window is full. */
+  if (sample_count == window_size) {
+    buckets[bucket_for(samples[next_sample])] -= 1;
+  } else {
+    sample_count += 1;
+  }
+
+  samples[next_sample] = static_cast<uint32_t>(ns);
+  buckets[bucket_for(ns)] += 1;
+  next_sample = (next_sample + 1) % window_size;
+}
+
+double
+TickProfile::PhaseTimes::get_mean_ns() const {
+  if (calls == 0) return 0.;
+  return static_cast<double>(total_ns) / calls;
+}
+
+uint64_t
+TickProfile::PhaseTimes::get_last_ns() const {
+  if (sample_count == 0) return 0;
+  return samples[(next_sample + window_size - 1) % window_size];
+}
+
+uint64_t
+TickProfile::PhaseTimes::get_window_max_ns() const {
+  uint64_t result = 0;
+  for (size_t i = 0; i < sample_count; i++) {
+    if (samples[i] > result) result = samples[i];
+  }
+  return result;
+}
+
+double
+TickProfile::PhaseTimes::get_window_mean_ns() const {
+  if (sample_count == 0) return 0.;
+  uint64_t sum = 0;
+  for (size_t i = 0; i < sample_count; i++) sum += samples[i];
+  return static_cast<double>(sum) / sample_count;
+}
+
+uint64_t
+TickProfile::PhaseTimes::get_window_percentile_ns(double percentile) const {
+  if (sample_count == 0) return 0;
+
+  uint64_t rank = static_cast<uint64_t>(percentile / 100. * sample_count + .5);
+  if (rank < 1) rank = 1;
+  if (rank > sample_count) rank = sample_count;
+
+  uint64_t seen = 0;
+  for (size_t i = 0; i < bucket_count; i++) {
+    seen += buckets[i];
+    if (seen >= rank) return (static_cast<uint64_t>(1) << (i + 1)) - 1;
+  }
+  return get_window_max_ns();
+}
+
+const char *
+TickProfile::get_phase_name(Phase phase) {
+  static const char *names[] = {
+    "serf_request_failure",
+    "map",
+    "players",
+    "knight_morale",
+    "inventories",
+    "flags",
+    "buildings",
+    "serfs",
+    "game_stats",
+    "total"
+  };
+  return names[phase];
+}
+
+void
+TickProfile::reset() {
+  for (size_t i = 0; i < PhaseCount; i++) phases[i].reset();
+}
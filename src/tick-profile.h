@@ -0,0 +1,131 @@
+/*
+ * tick-profile.h - Timing of game update phases
+ *
+ * Copyright (C) 2018  Wicked_Digger <wicked_digger@mail.ru>
+ *
+ * This file is part of freeserf.
+ *
+ * freeserf is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * freeserf is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with freeserf.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SRC_TICK_PROFILE_H_
+#define SRC_TICK_PROFILE_H_
+
+#include <chrono>
+#include <cstdint>
+#include <cstddef>
+
+/* Timing of the phases of Game::update().
+
+   Each phase keeps lifetime totals and a rolling window of the most
+   recent samples, summarized as a log2 histogram of nanoseconds. The
+   timers are only compiled in when ENABLE_PROFILING is defined;
+   otherwise TICK_PROFILE_PHASE expands to nothing and Game holds no
+   profile. */
+class TickProfile {
+ public:
+  typedef enum Phase {
+    PhaseSerfRequestFailure = 0,
+    PhaseMap,
+    PhasePlayers,
+    PhaseKnightMorale,
+    PhaseInventories,
+    PhaseFlags,
+    PhaseBuildings,
+    PhaseSerfs,
+    PhaseGameStats,
+    PhaseTotal,
+
+    PhaseCount
+  } Phase;
+
+  /* Number of recent samples kept per phase. */
+  static const size_t window_size = 512;
+  /* Histogram buckets; bucket i holds samples in [2^i, 2^(i+1)) ns. */
+  static const size_t bucket_count = 32;
+
+  class PhaseTimes {
+   protected:
+    uint64_t calls;
+    uint64_t total_ns;
+    uint64_t max_ns;
+    uint32_t samples[window_size];
+    size_t next_sample;
+    size_t sample_count;
+    unsigned int buckets[bucket_count];
+
+   public:
+    PhaseTimes() { reset(); }
+
+    void reset();
+    void record(uint64_t ns);
+
+    /* Lifetime values */
+    uint64_t get_calls() const { return calls; }
+    uint64_t get_total_ns() const { return total_ns; }
+    uint64_t get_max_ns() const { return max_ns; }
+    double get_mean_ns() const;
+
+    /* Values over the rolling window */
+    size_t get_window_count() const { return sample_count; }
+    unsigned int get_bucket(size_t bucket) const { return buckets[bucket]; }
+    uint64_t get_last_ns() const;
+    uint64_t get_window_max_ns() const;
+    double get_window_mean_ns() const;
+    /* Upper bound of the histogram bucket holding the given percentile. */
+    uint64_t get_window_percentile_ns(double percentile) const;
+
+   protected:
+    static size_t bucket_for(uint64_t ns);
+  };
+
+  class Timer {
+   protected:
+    typedef std::chrono::steady_clock Clock;
+
+    TickProfile *profile;
+    Phase phase;
+    Clock::time_point start;
+
+   public:
+    Timer(TickProfile *profile, Phase phase)
+      : profile(profile), phase(phase), start(Clock::now()) {}
+    ~Timer() {
+      profile->record(phase, std::chrono::duration_cast<
+        std::chrono::nanoseconds>(Clock::now() - start).count());
+    }
+  };
+
+ protected:
+  PhaseTimes phases[PhaseCount];
+
+ public:
+  static const char *get_phase_name(Phase phase);
+
+  void record(Phase phase, uint64_t ns) { phases[phase].record(ns); }
+  const PhaseTimes &get_phase(Phase phase) const { return phases[phase]; }
+  void reset();
+};
+
+#ifdef ENABLE_PROFILING
+# define TICK_PROFILE_CONCAT_(a, b)  a ## b
+# define TICK_PROFILE_CONCAT(a, b)  TICK_PROFILE_CONCAT_(a, b)
+# define TICK_PROFILE_PHASE(profile, phase) \
+  TickProfile::Timer TICK_PROFILE_CONCAT(tick_profile_timer_, __LINE__)( \
+    (profile), TickProfile::phase)
+#else
+# define TICK_PROFILE_PHASE(profile, phase)
+#endif
+
+#endif  // SRC_TICK_PROFILE_H_
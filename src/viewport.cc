@@ -48,6 +48,9 @@
 #define MAP_TILE_COLS  16
 #define MAP_TILE_ROWS  16
 
+/* Positions the road preview search settles per update at most */
+#define VIEWPORT_ROAD_PREVIEW_SETTLED  4096
+
 static const uint8_t tri_spr[] = {
   32, 32, 32, 32, 32, 32, 32, 32,
   32, 32, 32, 32, 32, 32, 32, 32,
@@ -621,6 +624,26 @@ Viewport::draw_paths_and_borders() {
 
       pos = map->move(pos, dir);
     }
+
+    draw_road_preview();
+  }
+}
+
+void
+Viewport::draw_road_preview() {
+  if (!road_preview.is_valid()) return;
+
+  const Color color(0xef, 0xef, 0x8f);
+  MapPos pos = road_preview.get_source();
+  int sx, sy;
+  screen_pix_from_map_coord(pos, &sx, &sy);
+  for (Direction dir : road_preview.get_dirs()) {
+    pos = map->move(pos, dir);
+    int next_x, next_y;
+    screen_pix_from_map_coord(pos, &next_x, &next_y);
+    frame->draw_line(sx, sy, next_x, next_y, color);
+    sx = next_x;
+    sy = next_y;
   }
 }
 
@@ -2357,6 +2380,39 @@ Viewport::handle_click_left(int lx, int ly) {
   return true;
 }
 
+bool
+Viewport::handle_mouse_move(int lx, int ly) {
+  hover_pos = map_pos_from_screen_pix(lx, ly);
+  if (update_road_preview()) set_redraw();
+
+  return false;
+}
+
+/* Update the road preview to the position under the mouse. The search
+   behind it is spread over several updates if the position is far away.
+   Returns true if the preview changed. */
+bool
+Viewport::update_road_preview() {
+  Road road;
+  if (interface->is_building_road() && hover_pos != bad_map_pos) {
+    const Road &building_road = interface->get_building_road();
+    road_planner.set_building_road(map.get(), building_road);
+    if (hover_pos != building_road.get_end(map.get())) {
+      road_planner.get_road(hover_pos, &road, VIEWPORT_ROAD_PREVIEW_SETTLED);
+    }
+  } else {
+    road_planner.reset();
+  }
+
+  if (road.get_source() == road_preview.get_source() &&
+      road.get_dirs() == road_preview.get_dirs()) {
+    return false;
+  }
+
+  road_preview = road;
+  return true;
+}
+
 bool
 Viewport::handle_dbl_click(int lx, int ly, Event::Button button) {
   if (button != Event::ButtonLeft) return 0;
@@ -2499,7 +2555,8 @@ Viewport::handle_drag(int lx, int ly) {
 
 Viewport::Viewport(Interface *_interface, PMap _map)
   : interface(_interface)
-  , map(_map) {
+  , map(_map)
+  , hover_pos(bad_map_pos) {
   map->add_change_handler(this);
   layers = LayerAll;
 
@@ -2518,16 +2575,28 @@ Viewport::~Viewport() {
 
 void
 Viewport::on_height_changed(MapPos pos) {
+  road_planner.map_changed(pos);
   redraw_map_pos(pos);
 }
 
 void
 Viewport::on_object_changed(MapPos pos) {
+  road_planner.map_changed(pos);
   if (interface->get_map_cursor_pos() == pos) {
     interface->update_map_cursor_pos(pos);
   }
 }
 
+void
+Viewport::on_owner_changed(MapPos pos) {
+  road_planner.map_changed(pos);
+}
+
+void
+Viewport::on_paths_changed(MapPos pos) {
+  road_planner.map_changed(pos);
+}
+
 /* Space transformations. */
 /* The game world space is a three dimensional space with the axes
    named "column", "row" and "height". The (column, row) coordinate
@@ -2721,4 +2790,6 @@ Viewport::update() {
   if (tick_xor >= 1 << 3) {
     set_redraw();
   }
+
+  if (update_road_preview()) set_redraw();
 }
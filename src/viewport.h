@@ -28,6 +28,7 @@
 #include "src/gui.h"
 #include "src/map.h"
 #include "src/building.h"
+#include "src/pathfinder.h"
 
 class Interface;
 class DataSource;
@@ -62,6 +63,12 @@ class Viewport : public GuiObject, public Map::Handler {
 
   PMap map;
 
+  /* Preview of the road from the end of the road being built to the
+     position under the mouse. */
+  MapPos hover_pos;
+  RoadTreePathfinder road_planner;
+  Road road_preview;
+
  public:
   Viewport(Interface *interface, PMap map);
   virtual ~Viewport();
@@ -94,6 +101,7 @@ class Viewport : public GuiObject, public Map::Handler {
   void draw_path_segment(int x, int y, MapPos pos, Direction dir);
   void draw_border_segment(int x, int y, MapPos pos, Direction dir);
   void draw_paths_and_borders();
+  void draw_road_preview();
   void draw_game_sprite(int x, int y, int index);
   void draw_serf(int x, int y, const Color &color, int head, int body);
   void draw_shadow_and_building_sprite(int x, int y, int index,
@@ -123,18 +131,22 @@ class Viewport : public GuiObject, public Map::Handler {
   void draw_height_grid_overlay(const Color &color);
   MapPos get_offset(int *x_off, int *y_off,
                     int *col = nullptr, int *row = nullptr);
+  bool update_road_preview();
 
   virtual void internal_draw();
   virtual void layout();
   virtual bool handle_click_left(int x, int y);
   virtual bool handle_dbl_click(int x, int y, Event::Button button);
   virtual bool handle_drag(int x, int y);
+  virtual bool handle_mouse_move(int x, int y);
 
   Frame *get_tile_frame(unsigned int tid, int tc, int tr);
 
  public:
   virtual void on_height_changed(MapPos pos);
   virtual void on_object_changed(MapPos pos);
+  virtual void on_owner_changed(MapPos pos);
+  virtual void on_paths_changed(MapPos pos);
 };
 
 #endif  // SRC_VIEWPORT_H_
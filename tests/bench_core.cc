@@ -0,0 +1,269 @@
+/*
+ * bench_core.cc - Microbenchmarks of the core engine functions
+ *
+ * Copyright (C) 2018  Wicked_Digger <wicked_digger@mail.ru>
+ *
+ * This file is part of freeserf.
+ *
+ * freeserf is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * freeserf is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with freeserf.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Usage: bench_core [MAP_SIZE...]
+ *
+ * Times the hot kernels of the engine on stress scenarios of the given map
+ * sizes (3, 4 and 5 by default) and prints the results as JSON. Every kernel
+ * is repeated until it ran for at least BENCH_MIN_TIME seconds.
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "src/flag.h"
+#include "src/game.h"
+#include "src/inventory.h"
+#include "src/log.h"
+#include "src/map-generator.h"
+#include "src/pathfinder.h"
+#include "src/pathfinder-hierarchy.h"
+#include "src/random.h"
+#include "src/savegame.h"
+#include "src/stress-scenario.h"
+
+/* Minimum run time of each kernel in seconds. */
+#define BENCH_MIN_TIME  0.25
+/* Maximum number of repetitions of each kernel. */
+#define BENCH_MAX_ITERATIONS  100000
+
+typedef std::chrono::steady_clock Clock;
+
+class BenchResult {
+ public:
+  std::string kernel;
+  unsigned int map_size;
+  unsigned int iterations;
+  double mean_us;
+  double min_us;
+};
+
+/* Run kernel repeatedly and record the time of each call. */
+static BenchResult
+measure(const std::string &kernel, unsigned int map_size,
+        std::function<void(unsigned int)> func) {
+  BenchResult result;
+  result.kernel = kernel;
+  result.map_size = map_size;
+  result.iterations = 0;
+  result.min_us = 0.;
+
+  double total = 0.;
+  while (total < BENCH_MIN_TIME &&
+         result.iterations < BENCH_MAX_ITERATIONS) {
+    Clock::time_point start = Clock::now();
+    func(result.iterations);
+    std::chrono::duration<double> elapsed = Clock::now() - start;
+
+    double us = elapsed.count() * 1000000.;
+    if (result.iterations == 0 || us < result.min_us) result.min_us = us;
+    total += elapsed.count();
+    result.iterations += 1;
+  }
+
+  result.mean_us = total * 1000000. / result.iterations;
+  return result;
+}
+
+static bool
+visit_all_cb(Flag * /*flag*/, void *data) {
+  unsigned int *count = static_cast<unsigned int*>(data);
+  *count += 1;
+  return false;
+}
+
+static void
+bench_map_size(unsigned int map_size, std::vector<BenchResult> *results) {
+  const Random seed("8667715887436237");
+
+  /* Map generation */
+  results->push_back(measure("ClassicMapGenerator::generate", map_size,
+                             [&](unsigned int) {
+    Map map{MapGeometry(map_size)};
+    ClassicMapGenerator generator(map, seed);
+    generator.init(MapGenerator::HeightGeneratorMidpoints, false);
+    generator.generate();
+  }));
+
+  /* The other kernels run on a grown economy. */
+  StressScenario scenario(map_size, 4, seed);
+  scenario.set_target_flags(25 << (map_size - 3));
+  scenario.set_max_ticks(20000);
+  if (!scenario.generate()) {
+    std::cerr << "Failed to grow a scenario of map size " << map_size
+              << ", skipping the remaining kernels\n";
+    return;
+  }
+  PGame game = scenario.get_game();
+  PMap map = game->get_map();
+
+  std::vector<MapPos> flag_pos;
+  std::vector<MapPos> building_pos;
+  for (MapPos pos : map->geom()) {
+    if (map->has_flag(pos)) {
+      flag_pos.push_back(pos);
+    } else if (map->has_building(pos)) {
+      building_pos.push_back(pos);
+    }
+  }
+  if (flag_pos.empty()) return;
+
+  Random rnd(seed);
+  std::vector<MapPos> path_pairs;
+  for (int i = 0; i < 256; i++) {
+    path_pairs.push_back(flag_pos[rnd.random() % flag_pos.size()]);
+  }
+
+  results->push_back(measure("pathfinder_map", map_size,
+                             [&](unsigned int i) {
+    MapPos start = path_pairs[(2*i) % path_pairs.size()];
+    MapPos end = path_pairs[(2*i + 1) % path_pairs.size()];
+    pathfinder_map(map.get(), start, end);
+  }));
+
+  HierarchicalPathfinder hierarchy(map);
+  results->push_back(measure("HierarchicalPathfinder::find_road", map_size,
+                             [&](unsigned int i) {
+    MapPos start = path_pairs[(2*i) % path_pairs.size()];
+    MapPos end = path_pairs[(2*i + 1) % path_pairs.size()];
+    hierarchy.find_road(start, end);
+  }));
+
+  std::vector<RoadBatchPathfinder::Query> queries;
+  for (size_t i = 0; i + 1 < path_pairs.size(); i += 2) {
+    queries.push_back(std::make_pair(path_pairs[i], path_pairs[i+1]));
+  }
+  RoadBatchPathfinder batch(*map);
+  results->push_back(measure("RoadBatchPathfinder::find_roads", map_size,
+                             [&](unsigned int) {
+    batch.find_roads(queries);
+  }));
+
+  /* Repeated queries between connectable flags, answered from the cache
+     (failed searches are not cached). */
+  std::vector<std::pair<MapPos, MapPos>> road_pairs;
+  for (size_t i = 0; i + 1 < path_pairs.size(); i += 2) {
+    if (pathfinder_map(map.get(), path_pairs[i], path_pairs[i+1]).is_valid()) {
+      road_pairs.push_back(std::make_pair(path_pairs[i], path_pairs[i+1]));
+    }
+  }
+  if (!road_pairs.empty()) {
+    RoadCache road_cache(map);
+    results->push_back(measure("RoadCache::find_road", map_size,
+                               [&](unsigned int i) {
+      const std::pair<MapPos, MapPos> &pair = road_pairs[i % road_pairs.size()];
+      road_cache.find_road(pair.first, pair.second);
+    }));
+  }
+
+  std::vector<Flag*> sources;
+  for (unsigned int i = 0; i < scenario.max_players; i++) {
+    Player *player = game->get_player(i);
+    if (player == nullptr) break;
+    for (Inventory *inventory : game->get_player_inventories(player)) {
+      sources.push_back(game->get_flag(inventory->get_flag_index()));
+    }
+  }
+
+  results->push_back(measure("FlagSearch::execute", map_size,
+                             [&](unsigned int i) {
+    unsigned int count = 0;
+    FlagSearch search(game.get());
+    search.add_source(sources[i % sources.size()]);
+    search.execute(visit_all_cb, true, false, &count);
+  }));
+
+  Random map_rnd(seed);
+  unsigned int tick = game->get_tick();
+  results->push_back(measure("Map::update", map_size, [&](unsigned int) {
+    /* Every 20 ticks the map updates one position in each region. */
+    tick += 20;
+    map->update(tick, &map_rnd);
+  }));
+
+  if (!building_pos.empty()) {
+    results->push_back(measure("Game::update_land_ownership", map_size,
+                               [&](unsigned int i) {
+      game->update_land_ownership(building_pos[i % building_pos.size()]);
+    }));
+  }
+
+  std::string save;
+  results->push_back(measure("GameStore::write", map_size,
+                             [&](unsigned int) {
+    std::stringstream str;
+    GameStore::get_instance()->write(&str, game.get());
+    save = str.str();
+  }));
+
+  results->push_back(measure("GameStore::read", map_size,
+                             [&](unsigned int) {
+    std::stringstream str(save);
+    std::unique_ptr<Game> loaded(new Game());
+    GameStore::get_instance()->read(&str, loaded.get());
+  }));
+}
+
+int
+main(int argc, char *argv[]) {
+  std::vector<unsigned int> map_sizes;
+  for (int i = 1; i < argc; i++) {
+    int size = std::atoi(argv[i]);
+    if (size < 3 || size > 10) {
+      std::cerr << "Usage: " << argv[0] << " [MAP_SIZE...]\n";
+      return EXIT_FAILURE;
+    }
+    map_sizes.push_back(size);
+  }
+  if (map_sizes.empty()) map_sizes = { 3, 4, 5 };
+
+  Log::set_file(&std::cerr);
+  Log::set_level(Log::LevelError);
+
+  std::vector<BenchResult> results;
+  for (unsigned int map_size : map_sizes) {
+    bench_map_size(map_size, &results);
+  }
+
+  std::cout << std::fixed << std::setprecision(3);
+  std::cout << "{\n  \"results\": [";
+  for (size_t i = 0; i < results.size(); i++) {
+    const BenchResult &r = results[i];
+    std::cout << (i == 0 ? "\n" : ",\n")
+              << "    {\"kernel\": \"" << r.kernel << "\""
+              << ", \"map_size\": " << r.map_size
+              << ", \"iterations\": " << r.iterations
+              << ", \"mean_us\": " << r.mean_us
+              << ", \"min_us\": " << r.min_us << "}";
+  }
+  std::cout << "\n  ]\n}\n";
+
+  return EXIT_SUCCESS;
+}
@@ -126,3 +126,25 @@ TEST(Map, ClassicMissionMapGenerator) {
     }
   }
 }
+
+TEST(Map, SlopesFollowHeights) {
+  Map map(MapGeometry(3));
+  ClassicMapGenerator generator(map, Random("8667715887436237"));
+  generator.init(MapGenerator::HeightGeneratorMidpoints, false);
+  generator.generate();
+  map.init_tiles(generator);
+
+  Random random("3762425816724239");
+  for (int i = 0; i < 256; i++) {
+    MapPos pos = random.random() % map.geom().tile_count();
+    map.set_height(pos, random.random() % 32);
+  }
+
+  for (MapPos pos : map.geom()) {
+    for (Direction d : cycle_directions_cw()) {
+      int slope = static_cast<int>(map.get_height(map.move(pos, d))) -
+                  static_cast<int>(map.get_height(pos));
+      ASSERT_EQ(slope, map.get_slope(pos, d));
+    }
+  }
+}
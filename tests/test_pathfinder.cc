@@ -0,0 +1,353 @@
+/*
+ * test_pathfinder.cc - Road pathfinder tests
+ *
+ * Copyright (C) 2018  Wicked_Digger <wicked_digger@mail.ru>
+ *
+ * This file is part of freeserf.
+ *
+ * freeserf is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * freeserf is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with freeserf.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <gtest/gtest.h>
+
+#include <cstdlib>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "src/map.h"
+#include "src/map-generator.h"
+#include "src/pathfinder.h"
+#include "src/pathfinder-hierarchy.h"
+#include "src/random.h"
+
+static void
+generate_map(Map *map) {
+  ClassicMapGenerator generator(*map, Random("8667715887436237"));
+  generator.init(MapGenerator::HeightGeneratorMidpoints, false);
+  generator.generate();
+  map->init_tiles(generator);
+  for (MapPos pos : map->geom()) {
+    map->set_owner(pos, 0);  // Roads are only built on owned land
+  }
+}
+
+static unsigned int
+walk_cost(Map *map, const Road &road) {
+  const unsigned int cost[] = { 255, 319, 383, 447, 511 };
+  unsigned int total = 0;
+  MapPos pos = road.get_source();
+  for (Direction dir : road.get_dirs()) {
+    MapPos next = map->move(pos, dir);
+    total += cost[std::abs(static_cast<int>(map->get_height(pos)) -
+                           static_cast<int>(map->get_height(next)))];
+    pos = next;
+  }
+  return total;
+}
+
+TEST(Pathfinder, RoadsConnectEnds) {
+  Map map(MapGeometry(3));
+  generate_map(&map);
+
+  Random random("3762425816724239");
+  std::vector<MapPos> ends;
+  for (int i = 0; i < 64; i++) {
+    ends.push_back(random.random() % map.geom().tile_count());
+  }
+
+  // A shared pathfinder reuses its arrays between searches and must
+  // find the same roads as a new one.
+  RoadPathfinder shared;
+  unsigned int found = 0;
+  for (size_t i = 0; i + 1 < ends.size(); i++) {
+    Road road = shared.find_road(&map, ends[i], ends[i+1]);
+    Road fresh = RoadPathfinder().find_road(&map, ends[i], ends[i+1]);
+    ASSERT_EQ(fresh.is_valid(), road.is_valid());
+    if (!road.is_valid()) continue;
+    found += 1;
+
+    EXPECT_EQ(fresh.get_dirs(), road.get_dirs());
+    EXPECT_EQ(ends[i], road.get_source());
+    EXPECT_EQ(ends[i+1], road.get_end(&map));
+
+    MapPos pos = road.get_source();
+    for (Direction dir : road.get_dirs()) {
+      EXPECT_TRUE(map.is_road_segment_valid(pos, dir));
+      pos = map.move(pos, dir);
+    }
+  }
+  EXPECT_LT(0u, found);
+}
+
+TEST(Pathfinder, MatchesRecordedRoads) {
+  Map map(MapGeometry(3));
+  generate_map(&map);
+
+  // Directions of the roads found by pathfinder_map() before it was
+  // rewritten around flat arrays. Entries with a building length search
+  // from the end of that many steps of the road of the entry before, the
+  // steps being a road under construction.
+  const struct {
+    MapPos start;
+    size_t building_length;
+    MapPos end;
+    const char *dirs;
+  } recorded[] = {
+    { 1233, 0, 2112, "2322232222323333223333323333232" },
+    { 1233, 15, 1160, "5555444555" },
+    { 1275, 0, 900, "05055550000000" },
+    { 1275, 7, 322, "05550005055555" },
+    { 830, 0, 398, "5505500000505000000000" },
+    { 830, 11, 970, "12211111" },
+    { 286, 0, 610, "11121" },
+    { 286, 2, 740, "11112" },
+    { 3101, 0, 1868, "4544444444454444444" },
+    { 3101, 9, 2641, "332323" },
+    { 646, 0, 129, "0555444443" },
+    { 646, 5, 270, "0005000005" },
+    { 671, 0, 1817, "1222222233322232322222332" },
+    { 671, 12, 1880, "223232222233322" },
+    { 458, 0, 3974, "544554455" },
+    { 458, 4, 5, "5443" },
+    { 1126, 0, 1638, "22222222" },
+    { 1126, 4, 1968, "1111111110" },
+    { 499, 0, 429, "333334" },
+    { 499, 3, 1001, "222332223223333" },
+    { 34, 0, 846, "232222333223233223333333333232332" },
+    { 34, 16, 919, "333222232" },
+    { 2809, 0, 2429, "0505500555" },
+    { 2809, 5, 2225, "3334444443" },
+    { 2959, 0, 3415, "11111110" },
+    { 2959, 4, 3085, "334433" },
+    { 1826, 0, 2259, "2232233333233333332233" },
+    { 1826, 11, 2017, "45000000" },
+    { 1849, 0, 1268, "544544554" },
+    { 1849, 4, 1278, "050555500000" },
+    { 650, 0, 1681, "1111112222222212" },
+    { 650, 8, 1163, "33333" },
+  };
+
+  Road previous;
+  for (const auto &entry : recorded) {
+    Road building_road;
+    building_road.start(entry.start);
+    MapPos start = entry.start;
+    if (entry.building_length != 0) {
+      for (Direction dir : previous.get_dirs()) {
+        if (building_road.get_length() == entry.building_length) break;
+        building_road.extend(dir);
+      }
+      start = building_road.get_end(&map);
+    }
+
+    Road road = pathfinder_map(&map, start, entry.end,
+                               entry.building_length != 0 ?
+                                 &building_road : nullptr);
+    std::string dirs;
+    for (Direction dir : road.get_dirs()) {
+      dirs += static_cast<char>('0' + dir);
+    }
+    EXPECT_EQ(entry.dirs, dirs) << entry.start << " to " << entry.end;
+    previous = road;
+  }
+}
+
+TEST(Pathfinder, TreeFindsCheapestRoads) {
+  Map map(MapGeometry(3));
+  generate_map(&map);
+
+  Random random("3762425816724239");
+  Road building_road;
+  building_road.start(random.random() % map.geom().tile_count());
+  MapPos source = building_road.get_source();
+
+  // The tree continues the search over queries with a small limit. It
+  // finds the cheapest roads, while the heuristic of the search from
+  // scratch can overestimate and miss some of them.
+  RoadTreePathfinder tree;
+  tree.set_building_road(&map, building_road);
+  unsigned int found = 0;
+  for (int i = 0; i < 64; i++) {
+    MapPos end = random.random() % map.geom().tile_count();
+    Road road;
+    while (!tree.get_road(end, &road, 100)) {}
+    Road expected = RoadPathfinder().find_road(&map, source, end,
+                                               &building_road);
+    ASSERT_EQ(expected.is_valid(), road.is_valid());
+    if (!road.is_valid()) continue;
+    found += 1;
+
+    EXPECT_EQ(source, road.get_source());
+    EXPECT_EQ(end, road.get_end(&map));
+    EXPECT_LE(walk_cost(&map, road), walk_cost(&map, expected));
+  }
+  EXPECT_LT(0u, found);
+}
+
+TEST(Pathfinder, TreeFindsRoadsAfterChanges) {
+  Map map(MapGeometry(3));
+  generate_map(&map);
+
+  Random random("3762425816724239");
+  Road building_road;
+  building_road.start(random.random() % map.geom().tile_count());
+  MapPos end = bad_map_pos;
+  while (end == bad_map_pos) {
+    MapPos pos = random.random() % map.geom().tile_count();
+    Road road = RoadPathfinder().find_road(&map, building_road.get_source(),
+                                           pos, &building_road);
+    if (road.get_length() >= 2) end = pos;
+  }
+
+  // The end belongs to another player while the tree grows over the whole
+  // map. The tree never reached it, but finds the road once it is gained.
+  map.set_owner(end, 1);
+  RoadTreePathfinder tree;
+  tree.set_building_road(&map, building_road);
+  Road road;
+  ASSERT_TRUE(tree.get_road(end, &road));
+  EXPECT_FALSE(road.is_valid());
+
+  map.set_owner(end, 0);
+  tree.map_changed(end);
+  ASSERT_TRUE(tree.get_road(end, &road));
+  EXPECT_TRUE(road.is_valid());
+  EXPECT_EQ(end, road.get_end(&map));
+}
+
+TEST(Pathfinder, RoadCacheDropsChangedRoads) {
+  PMap map(new Map(MapGeometry(3)));
+  generate_map(map.get());
+
+  Random random("3762425816724239");
+  std::vector<MapPos> ends;
+  for (int i = 0; i < 32; i++) {
+    ends.push_back(random.random() % map->geom().tile_count());
+  }
+
+  RoadCache cache(map);
+  std::vector<Road> roads;
+  for (size_t i = 0; i + 1 < ends.size(); i++) {
+    roads.push_back(cache.find_road(ends[i], ends[i+1]));
+    Road expected = RoadPathfinder().find_road(map.get(), ends[i], ends[i+1]);
+    EXPECT_EQ(expected.get_dirs(), roads.back().get_dirs());
+  }
+  size_t size = cache.get_size();
+  ASSERT_LT(0u, size);
+
+  // Repeated queries are answered from the cache
+  for (size_t i = 0; i + 1 < ends.size(); i++) {
+    EXPECT_EQ(roads[i].get_dirs(),
+              cache.find_road(ends[i], ends[i+1]).get_dirs());
+  }
+  EXPECT_EQ(size, cache.get_size());
+
+  // A stone placed on a road drops it, and the new road avoids the stone
+  size_t index = 0;
+  while (roads[index].get_length() < 2) index += 1;
+  MapPos pos = map->move(roads[index].get_source(),
+                         roads[index].get_dirs().front());
+  map->set_object(pos, Map::ObjectStone0, -1);
+  EXPECT_GT(size, cache.get_size());
+
+  Road road = cache.find_road(ends[index], ends[index+1]);
+  EXPECT_FALSE(road.has_pos(map.get(), pos));
+
+  // So does a road built on the map
+  size = cache.get_size();
+  ASSERT_TRUE(map->place_road_segments(road));
+  EXPECT_GT(size, cache.get_size());
+}
+
+TEST(Pathfinder, HierarchyFindsLongRoads) {
+  PMap map(new Map(MapGeometry(5)));
+  generate_map(map.get());
+
+  Random random("3762425816724239");
+  HierarchicalPathfinder hierarchy(map);
+  RoadPathfinder pathfinder;
+  unsigned int cost = 0;
+  unsigned int expected_cost = 0;
+  Road long_road;
+  for (int i = 0; i < 64; i++) {
+    MapPos start = random.random() % map->geom().tile_count();
+    MapPos end = random.random() % map->geom().tile_count();
+    Road road = hierarchy.find_road(start, end);
+    Road expected = pathfinder.find_road(map.get(), start, end);
+    if (expected.get_length() > 256) expected = Road();  // Too long to build
+    ASSERT_EQ(expected.is_valid(), road.is_valid());
+    if (!road.is_valid()) continue;
+
+    EXPECT_EQ(start, road.get_source());
+    EXPECT_EQ(end, road.get_end(map.get()));
+    MapPos pos = start;
+    for (Direction dir : road.get_dirs()) {
+      pos = map->move(pos, dir);
+      EXPECT_TRUE(map->is_road_segment_valid(pos, reverse_direction(dir)));
+    }
+    cost += walk_cost(map.get(), road);
+    expected_cost += walk_cost(map.get(), expected);
+    if (road.get_length() > long_road.get_length()) long_road = road;
+  }
+  // Roads through the entrances of the clusters cost a bit more
+  EXPECT_LE(cost, expected_cost * 5 / 4);
+  ASSERT_LT(2u * HierarchicalPathfinder::cluster_size, long_road.get_length());
+
+  // A stone placed on a road is avoided by the next search
+  MapPos pos = long_road.get_source();
+  Road::Dirs dirs = long_road.get_dirs();
+  dirs.resize(dirs.size() / 2);
+  for (Direction dir : dirs) pos = map->move(pos, dir);
+  map->set_object(pos, Map::ObjectStone0, -1);
+  Road road = hierarchy.find_road(long_road.get_source(),
+                                  long_road.get_end(map.get()));
+  EXPECT_FALSE(road.has_pos(map.get(), pos));
+}
+
+TEST(Pathfinder, BatchMatchesSingleSearches) {
+  Map map(MapGeometry(4));
+  generate_map(&map);
+
+  Random random("3762425816724239");
+  std::vector<RoadBatchPathfinder::Query> queries;
+  for (int i = 0; i < 128; i++) {
+    MapPos start = random.random() % map.geom().tile_count();
+    MapPos end = random.random() % map.geom().tile_count();
+    queries.push_back(std::make_pair(start, end));
+  }
+
+  RoadBatchPathfinder batch(map, 4);
+  std::vector<Road> roads = batch.find_roads(queries);
+  ASSERT_EQ(queries.size(), roads.size());
+  RoadPathfinder pathfinder;
+  size_t index = queries.size();
+  for (size_t i = 0; i < queries.size(); i++) {
+    Road expected = pathfinder.find_road(&map, queries[i].first,
+                                         queries[i].second);
+    EXPECT_EQ(expected.is_valid(), roads[i].is_valid());
+    EXPECT_EQ(expected.get_dirs(), roads[i].get_dirs());
+    if (roads[i].get_length() >= 2) index = i;
+  }
+  ASSERT_GT(queries.size(), index);
+
+  // Changes of the map are only seen after an update
+  MapPos pos = map.move(roads[index].get_source(),
+                        roads[index].get_dirs().front());
+  map.set_object(pos, Map::ObjectStone0, -1);
+  std::vector<RoadBatchPathfinder::Query> query(1, queries[index]);
+  EXPECT_EQ(roads[index].get_dirs(), batch.find_roads(query)[0].get_dirs());
+  batch.update(map);
+  EXPECT_FALSE(batch.find_roads(query)[0].has_pos(&map, pos));
+}
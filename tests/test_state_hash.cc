@@ -0,0 +1,111 @@
+/*
+ * test_state_hash.cc - test of the game state hash
+ *
+ * Copyright (C) 2018  Wicked_Digger <wicked_digger@mail.ru>
+ *
+ * This file is part of freeserf.
+ *
+ * freeserf is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * freeserf is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with freeserf.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <gtest/gtest.h>
+
+#include <memory>
+#include <sstream>
+#include <string>
+
+#include "src/game.h"
+#include "src/map.h"
+#include "src/map-generator.h"
+#include "src/random.h"
+#include "src/savegame.h"
+#include "src/state-hash.h"
+#include "src/stress-scenario.h"
+
+static void
+generate_map(Map *map) {
+  ClassicMapGenerator generator(*map, Random("8667715887436237"));
+  generator.init(MapGenerator::HeightGeneratorMidpoints, false);
+  generator.generate();
+  map->init_tiles(generator);
+}
+
+static void
+change_map(Map *map) {
+  MapPos pos = map->pos(10, 12);
+  map->set_height(pos, 7);
+  map->set_object(pos, Map::ObjectFlag, 5);
+  map->set_owner(pos, 1);
+  map->add_path(pos, DirectionRight);
+  map->add_path(map->move_right(pos), DirectionLeft);
+  map->set_serf_index(map->move_right(pos), 3);
+}
+
+TEST(StateHash, IncrementalMapHash) {
+  // Hash taken before the changes and kept up to date by the setters
+  Map map(MapGeometry(3));
+  generate_map(&map);
+  uint64_t initial = map.get_state_hash();
+  change_map(&map);
+
+  // Hash computed from scratch after the changes
+  Map other(MapGeometry(3));
+  generate_map(&other);
+  change_map(&other);
+
+  EXPECT_NE(initial, map.get_state_hash());
+  EXPECT_EQ(other.get_state_hash(), map.get_state_hash());
+
+  // Reverting a change restores the hash
+  uint64_t changed = map.get_state_hash();
+  MapPos pos = map.pos(20, 3);
+  ASSERT_FALSE(map.has_owner(pos));
+  map.set_owner(pos, 3);
+  EXPECT_NE(changed, map.get_state_hash());
+  map.del_owner(pos);
+  EXPECT_EQ(changed, map.get_state_hash());
+}
+
+TEST(StateHash, LockstepGames) {
+  StressScenario scenario(3, 2, Random("8667715887436237"));
+  scenario.set_target_flags(10);
+  scenario.set_max_ticks(5000);
+  scenario.generate();
+
+  std::stringstream str;
+  ASSERT_TRUE(GameStore::get_instance()->write(&str,
+                                              scenario.get_game().get()));
+  std::string save = str.str();
+
+  std::unique_ptr<Game> games[2];
+  for (std::unique_ptr<Game> &game : games) {
+    std::stringstream in(save);
+    game.reset(new Game());
+    ASSERT_TRUE(GameStore::get_instance()->read(&in, game.get()));
+    game->speed_reset();
+  }
+
+  StateHashes first = games[0]->get_state_hashes();
+  for (int i = 0; i < 300; i++) {
+    games[0]->update();
+    games[1]->update();
+    StateHashes hashes = games[0]->get_state_hashes();
+    ASSERT_EQ(hashes, games[1]->get_state_hashes()) << "diverged at " << i;
+  }
+
+  StateHashes last = games[0]->get_state_hashes();
+  EXPECT_NE(first.get_combined(), last.get_combined());
+  EXPECT_NE(first.parts[StateHashes::PartSerfs],
+            last.parts[StateHashes::PartSerfs]);
+}
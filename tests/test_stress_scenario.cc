@@ -0,0 +1,281 @@
+/*
+ * test_stress_scenario.cc - Stress scenario generator tests
+ *
+ * Copyright (C) 2018  Wicked_Digger <wicked_digger@mail.ru>
+ *
+ * This file is part of freeserf.
+ *
+ * freeserf is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * freeserf is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with freeserf.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <sstream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "src/flag.h"
+#include "src/game.h"
+#include "src/inventory.h"
+#include "src/pathfinder.h"
+#include "src/random.h"
+#include "src/savegame.h"
+#include "src/stress-scenario.h"
+
+static std::string
+generate_scenario(unsigned int *flags) {
+  StressScenario scenario(3, 2, Random("8667715887436237"));
+  scenario.set_target_flags(40);
+  scenario.set_max_ticks(20000);
+  EXPECT_TRUE(scenario.generate());
+
+  for (unsigned int i = 0; i < 2; i++) {
+    flags[i] = scenario.get_flag_count(i);
+  }
+
+  std::stringstream str;
+  EXPECT_TRUE(GameStore::get_instance()->write(&str,
+                                              scenario.get_game().get()));
+  return str.str();
+}
+
+// The economy is grown once, each test runs on its own copy.
+class StressEconomy : public ::testing::Test {
+ protected:
+  static std::string save;
+  static unsigned int flags[2];
+
+  PGame game;
+
+  static void SetUpTestCase() {
+    save = generate_scenario(flags);
+  }
+
+  virtual void SetUp() {
+    std::stringstream str(save);
+    game.reset(new Game());
+    ASSERT_TRUE(GameStore::get_instance()->read(&str, game.get()));
+    game->speed_reset();
+  }
+
+  std::vector<Flag*> get_flags() {
+    std::vector<Flag*> result;
+    for (MapPos pos : game->get_map()->geom()) {
+      if (game->get_map()->has_flag(pos)) {
+        result.push_back(game->get_flag_at_pos(pos));
+      }
+    }
+    return result;
+  }
+};
+
+std::string StressEconomy::save;
+unsigned int StressEconomy::flags[2];
+
+TEST_F(StressEconomy, GrowsEconomy) {
+  // Every player got more than its castle flag
+  EXPECT_GT(flags[0], 10u);
+  EXPECT_GT(flags[1], 10u);
+
+  // The same seed yields the same scenario
+  unsigned int flags_2[2];
+  EXPECT_EQ(save, generate_scenario(flags_2));
+
+  // The scenario loads and keeps running
+  for (int i = 0; i < 500; i++) game->update();
+}
+
+static bool
+find_flag_cb(Flag *flag, void *data) {
+  return flag == *static_cast<Flag**>(data);
+}
+
+// Serfs at a flag take the direction of the first road a search from all
+// its land roads reaches the destination by
+static void
+check_routes(Game *game, const std::vector<Flag*> &flags,
+             unsigned int *found) {
+  for (Flag *src : flags) {
+    for (Flag *dest : flags) {
+      if (dest == src) continue;
+      FlagSearch search(game);
+      for (Direction i : cycle_directions_ccw()) {
+        if (!src->is_water_path(i)) {
+          src->get_other_end_flag(i)->set_search_dir(i);
+          search.add_source(src->get_other_end_flag(i));
+        }
+      }
+      Direction expected = DirectionNone;
+      if (search.execute(find_flag_cb, true, false, &dest)) {
+        expected = dest->get_search_dir();
+        *found += 1;
+      }
+      ASSERT_EQ(expected, game->get_walking_dir(src, dest->get_index()));
+    }
+  }
+}
+
+TEST_F(StressEconomy, RoutesMatchFlagSearch) {
+  std::vector<Flag*> flags = get_flags();
+  unsigned int found = 0;
+  ASSERT_NO_FATAL_FAILURE(check_routes(game.get(), flags, &found));
+  EXPECT_LT(0u, found);
+
+  // Routes follow a new road, and its demolition
+  PMap map = game->get_map();
+  Player *player = game->get_player(0);
+  Road road;
+  for (Flag *src : flags) {
+    for (Flag *dest : flags) {
+      if (src->get_owner() != 0 || dest->get_owner() != 0) continue;
+      road = pathfinder_map(map.get(), src->get_position(),
+                            dest->get_position());
+      if (road.get_length() >= 2 && game->build_road(road, player)) break;
+      road = Road();
+    }
+    if (road.is_valid()) break;
+  }
+  ASSERT_TRUE(road.is_valid());
+  ASSERT_NO_FATAL_FAILURE(check_routes(game.get(), flags, &found));
+
+  MapPos pos = map->move(road.get_source(), road.get_dirs().front());
+  ASSERT_TRUE(game->demolish_road(pos, player));
+  ASSERT_NO_FATAL_FAILURE(check_routes(game.get(), flags, &found));
+}
+
+TEST_F(StressEconomy, NearestInventoryFollowsSerfMode) {
+  Inventory *inventory =
+    *game->get_player_inventories(game->get_player(0)).begin();
+  unsigned int castle_flag = inventory->get_flag_index();
+  Flag *flag = nullptr;
+  for (MapPos pos : game->get_map()->geom()) {
+    if (game->get_map()->has_flag(pos) &&
+        game->get_flag_at_pos(pos)->get_index() != castle_flag &&
+        game->get_flag_at_pos(pos)->find_nearest_inventory_for_serf() ==
+          static_cast<int>(castle_flag)) {
+      flag = game->get_flag_at_pos(pos);
+      break;
+    }
+  }
+  ASSERT_NE(nullptr, flag);
+
+  // The cached answer follows the inventory closing and opening again
+  game->set_inventory_serf_mode(inventory, 1);
+  EXPECT_NE(static_cast<int>(castle_flag),
+            flag->find_nearest_inventory_for_serf());
+  game->set_inventory_serf_mode(inventory, 0);
+  EXPECT_EQ(static_cast<int>(castle_flag),
+            flag->find_nearest_inventory_for_serf());
+}
+
+TEST_F(StressEconomy, ResourceDemandFollowsStocks) {
+  // Build the demand first, then let the buildings keep it up to date
+  game->get_resource_demand(0, Resource::TypePlank);
+  for (int i = 0; i < 5000; i++) game->update();
+
+  int requested = 0;
+  for (unsigned int i = 0; i < 2; i++) {
+    Player *player = game->get_player(i);
+    for (int res = 0; res <= Resource::GroupFood; res++) {
+      int expected = 0;
+      for (Building *building : game->get_player_buildings(player)) {
+        expected = std::max(expected,
+          building->get_max_priority_for_resource((Resource::Type)res, 1));
+      }
+      EXPECT_EQ(expected, game->get_resource_demand(i, (Resource::Type)res))
+        << "player " << i << " resource " << res;
+      if (expected > 0) requested += 1;
+    }
+  }
+  EXPECT_LT(0, requested);
+}
+
+static bool
+accepts_serfs_cb(Flag *flag, void * /*data*/) {
+  return flag->accepts_serfs();
+}
+
+TEST_F(StressEconomy, ComponentsHoldSearchedFlags) {
+  // Label the components first, then let the roads keep them up to date
+  std::vector<Flag*> flags = get_flags();
+  FlagComponents *components = game->get_flag_components();
+  for (Flag *flag : flags) {
+    components->reaches_inventory(flag, FlagComponents::RoadsLand);
+    components->reaches_inventory(flag, FlagComponents::RoadsTransporter);
+  }
+  for (int i = 0; i < 5000; i++) game->update();
+
+  flags = get_flags();
+  unsigned int connected = 0;
+  for (Flag *src : flags) {
+    for (Flag *dest : flags) {
+      Flag *found = dest;
+      if (FlagSearch::single(src, find_flag_cb, true, false, &found)) {
+        ASSERT_TRUE(components->is_connected(src, dest,
+                                             FlagComponents::RoadsLand));
+        connected += 1;
+      }
+      if (FlagSearch::single(src, find_flag_cb, false, true, &found)) {
+        ASSERT_TRUE(components->is_connected(src, dest,
+                                             FlagComponents::RoadsTransporter));
+      }
+    }
+    EXPECT_EQ(FlagSearch::single(src, accepts_serfs_cb, true, false, nullptr),
+              components->reaches_serf_inventory(src,
+                                                 FlagComponents::RoadsLand));
+  }
+  EXPECT_LT(flags.size(), connected);
+}
+
+TEST_F(StressEconomy, ComponentsFollowNewRoads) {
+  PMap map = game->get_map();
+  Player *player = game->get_player(0);
+  std::vector<Flag*> flags = get_flags();
+  FlagComponents *components = game->get_flag_components();
+
+  // A road from a new flag, labelled on its own, joins the component of
+  // the roads it connects to, which is not labelled yet
+  Flag *flag = nullptr;
+  for (MapPos pos : map->geom()) {
+    if (map->paths(pos) != 0 || !game->can_build_flag(pos, player)) {
+      continue;
+    }
+    ASSERT_TRUE(game->build_flag(pos, player));
+    Flag *new_flag = game->get_flag_at_pos(pos);
+    components->clear();
+    EXPECT_FALSE(components->reaches_inventory(new_flag,
+                                               FlagComponents::RoadsLand));
+    EXPECT_EQ(-1, new_flag->find_nearest_inventory_for_serf());
+    for (Flag *dest : flags) {
+      if (dest->get_owner() != 0 ||
+          !FlagSearch::single(dest, accepts_serfs_cb, true, false, nullptr)) {
+        continue;
+      }
+      Road road = pathfinder_map(map.get(), pos, dest->get_position());
+      if (road.is_valid() && game->build_road(road, player)) {
+        flag = new_flag;
+        break;
+      }
+    }
+    if (flag != nullptr) break;
+  }
+  ASSERT_NE(nullptr, flag);
+
+  EXPECT_TRUE(components->reaches_inventory(flag, FlagComponents::RoadsLand));
+  EXPECT_TRUE(components->reaches_serf_inventory(flag,
+                                                 FlagComponents::RoadsLand));
+  EXPECT_NE(-1, flag->find_nearest_inventory_for_serf());
+}